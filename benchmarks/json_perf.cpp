@@ -1,21 +1,43 @@
 #include "json.h"
+#include "nlohmann/nlohmann.h"
 
 #include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
 #include <functional>
+#include <new>
 #include <numeric>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#else
+#include <sys/resource.h>
+#endif
+
 #ifndef JTJSON_SOURCE_DIR
 #error "JTJSON_SOURCE_DIR must be defined"
 #endif
@@ -44,7 +66,21 @@ struct BenchConfig
     std::string filter;
     bool list_only = false;
     bool generate_report = false;
+    bool counters = false;
+    std::string compare;                // library to compare against
     std::string report_format = "text"; // text, csv, json, markdown
+    std::size_t gen_size = 1 << 20;     // bytes per generated document
+    std::uint64_t seed = 1;
+    std::string generate;               // shape to print instead of benchmarking
+    bool sweep = false;
+    bool latency = false;
+    std::size_t sweep_min = 1 << 10;
+    std::size_t sweep_max = 16 << 20;
+    std::size_t threads = 0;            // scale from 1 to this many threads
+    bool memory = false;
+    bool cold = false;
+    std::size_t cold_pool = 0;          // bytes, 0 for twice the LLC
+    std::string replay;                 // trace file to replay
 };
 
 struct BenchCase
@@ -56,6 +92,35 @@ struct BenchCase
     std::function<void()> body;
 };
 
+struct AllocStats
+{
+    double allocs_per_iteration = 0.0;
+    double bytes_per_iteration = 0.0;
+    double peak_live_bytes = 0.0;
+};
+
+enum CounterKind
+{
+    kCycles,
+    kInstructions,
+    kBranchMisses,
+    kL1DMisses,
+    kLLCMisses,
+    kCounterKinds
+};
+
+static const char* const kCounterNames[kCounterKinds] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"
+};
+
+// Per-iteration hardware counter averages. A counter the kernel or CPU
+// would not provide is negative.
+struct CounterStats
+{
+    bool available = false;
+    double per_iteration[kCounterKinds] = { -1, -1, -1, -1, -1 };
+};
+
 struct BenchResult
 {
     std::string name;
@@ -63,10 +128,88 @@ struct BenchResult
     std::size_t iterations;
     std::size_t bytes_per_iteration;
     double throughput_mb_s;
+    AllocStats allocs;
+    CounterStats counters;
 };
 
 static volatile std::uint64_t g_sink = 0;
 
+// The allocation hooks below replace operator new and delete for the
+// whole binary, so they stay a plain malloc and free plus one relaxed
+// load unless a counting pass has switched tracking on. Blocks carry no
+// header. Live bytes are the usable sizes malloc reports, so a free
+// during a pass lowers them even for a block allocated before it, and
+// they measure net heap growth since the pass began.
+static std::atomic<bool> g_alloc_tracking(false);
+static std::atomic<std::uint64_t> g_alloc_count(0);
+static std::atomic<std::uint64_t> g_alloc_bytes(0);
+static std::atomic<std::int64_t> g_alloc_live(0);
+static std::atomic<std::int64_t> g_alloc_peak(0);
+
+static std::int64_t
+UsableSize(void* ptr)
+{
+#ifdef __GLIBC__
+    return static_cast<std::int64_t>(malloc_usable_size(ptr));
+#else
+    (void)ptr;
+    return 0; // live and peak bytes stay zero
+#endif
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline, cold))
+#endif
+static void
+CountAlloc(void* ptr, std::size_t size)
+{
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    const std::int64_t usable = UsableSize(ptr);
+    std::int64_t live = g_alloc_live.fetch_add(usable, std::memory_order_relaxed) + usable;
+    std::int64_t peak = g_alloc_peak.load(std::memory_order_relaxed);
+    while (live > peak &&
+           !g_alloc_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline, cold))
+#endif
+static void
+CountFree(void* ptr)
+{
+    g_alloc_live.fetch_sub(UsableSize(ptr), std::memory_order_relaxed);
+}
+
+static inline void*
+CountedAlloc(std::size_t size)
+{
+    void* ptr = std::malloc(size ? size : 1);
+    if (ptr && g_alloc_tracking.load(std::memory_order_relaxed)) {
+        CountAlloc(ptr, size);
+    }
+    return ptr;
+}
+
+// GCC sees the free() of a block from the replaced operator new once
+// both are inlined into the same caller and calls it a mismatch.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+static inline void
+CountedFree(void* ptr)
+{
+    if (ptr && g_alloc_tracking.load(std::memory_order_relaxed)) {
+        CountFree(ptr);
+    }
+    std::free(ptr);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
 template <class T>
 inline void DoNotOptimize(const T& value)
 {
@@ -94,6 +237,125 @@ inline void Ensure(bool condition, const std::string& message)
     }
 }
 
+// Hardware counters for the measured loops, read through one
+// perf_event_open group led by the cycle counter. Only user space is
+// counted so the default perf_event_paranoid setting suffices. Events
+// the machine lacks, common under virtualization, are dropped one at a
+// time; if even cycles cannot be opened the benchmarks run without
+// counters.
+class PerfCounters
+{
+  public:
+    PerfCounters()
+    {
+        for (int i = 0; i < kCounterKinds; ++i) {
+            fds_[i] = -1;
+            totals_[i] = 0;
+        }
+    }
+
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for (int i = 0; i < kCounterKinds; ++i) {
+            if (fds_[i] >= 0) {
+                close(fds_[i]);
+            }
+        }
+#endif
+    }
+
+    bool open(std::string& error)
+    {
+#ifdef __linux__
+        static const struct
+        {
+            std::uint32_t type;
+            std::uint64_t config;
+        } kEvents[kCounterKinds] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HW_CACHE,
+              PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+            { PERF_TYPE_HW_CACHE,
+              PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        };
+        for (int i = 0; i < kCounterKinds; ++i) {
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = kEvents[i].type;
+            attr.config = kEvents[i].config;
+            attr.disabled = i == kCycles;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format =
+              PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int group = i == kCycles ? -1 : fds_[kCycles];
+            fds_[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+            if (fds_[i] < 0 && i == kCycles) {
+                error = std::string("perf_event_open: ") + std::strerror(errno);
+                if (errno == EACCES || errno == EPERM) {
+                    error += " (see /proc/sys/kernel/perf_event_paranoid)";
+                }
+                return false;
+            }
+        }
+        return true;
+#else
+        error = "hardware counters need Linux perf_event_open";
+        return false;
+#endif
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        ioctl(fds_[kCycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds_[kCycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    void stop()
+    {
+#ifdef __linux__
+        ioctl(fds_[kCycles], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        for (int i = 0; i < kCounterKinds; ++i) {
+            std::uint64_t values[3];
+            if (fds_[i] < 0 || read(fds_[i], values, sizeof(values)) != sizeof(values)) {
+                continue;
+            }
+            // Scale up if the kernel had to multiplex the group.
+            double count = static_cast<double>(values[0]);
+            if (values[2] > 0 && values[2] < values[1]) {
+                count *= static_cast<double>(values[1]) / values[2];
+            }
+            totals_[i] += count;
+        }
+#endif
+    }
+
+    CounterStats take(std::size_t iterations)
+    {
+        CounterStats stats;
+        stats.available = true;
+        for (int i = 0; i < kCounterKinds; ++i) {
+            if (fds_[i] >= 0) {
+                stats.per_iteration[i] = totals_[i] / iterations;
+            }
+            totals_[i] = 0;
+        }
+        return stats;
+    }
+
+  private:
+    int fds_[kCounterKinds];
+    double totals_[kCounterKinds];
+};
+
 inline Stats
 ComputeStats(std::vector<double> samples)
 {
@@ -145,6 +407,65 @@ ClampIterations(std::size_t base, double scale)
     return static_cast<std::size_t>(scaled);
 }
 
+inline bool
+HasCounters(const std::vector<BenchResult>& results)
+{
+    for (const auto& r : results) {
+        if (r.counters.available) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline double
+CounterPerByte(const CounterStats& counters, int kind, std::size_t bytes)
+{
+    if (bytes == 0 || counters.per_iteration[kind] < 0) {
+        return -1;
+    }
+    return counters.per_iteration[kind] / bytes;
+}
+
+inline double
+InstructionsPerCycle(const CounterStats& counters)
+{
+    if (counters.per_iteration[kCycles] <= 0 || counters.per_iteration[kInstructions] < 0) {
+        return -1;
+    }
+    return counters.per_iteration[kInstructions] / counters.per_iteration[kCycles];
+}
+
+// Prints a counter value, or "n/a" for one that was not collected.
+inline void
+PrintCounterValue(const char* format, double value)
+{
+    if (value < 0) {
+        std::printf("n/a");
+    } else {
+        std::printf(format, value);
+    }
+}
+
+inline void
+PrintCounterLine(const CounterStats& counters, std::size_t bytes)
+{
+    std::printf("%-32s", "");
+    for (int i = 0; i < kCounterKinds; ++i) {
+        std::printf(" %s=", kCounterNames[i]);
+        PrintCounterValue("%.0f", counters.per_iteration[i]);
+    }
+    std::printf(" ipc=");
+    PrintCounterValue("%.2f", InstructionsPerCycle(counters));
+    if (bytes > 0) {
+        std::printf("  per byte: cycles=");
+        PrintCounterValue("%.2f", CounterPerByte(counters, kCycles, bytes));
+        std::printf(" instructions=");
+        PrintCounterValue("%.2f", CounterPerByte(counters, kInstructions, bytes));
+    }
+    std::printf("\n");
+}
+
 inline void
 PrintTextReport(const std::vector<BenchResult>& results, const BenchConfig& config)
 {
@@ -166,21 +487,36 @@ PrintTextReport(const std::vector<BenchResult>& results, const BenchConfig& conf
         if (r.throughput_mb_s > 0.0) {
             std::printf("  throughput=%.2f MB/s", r.throughput_mb_s);
         }
+        std::printf("  allocs=%.1f bytes=%.0f peak=%.0f",
+                    r.allocs.allocs_per_iteration,
+                    r.allocs.bytes_per_iteration,
+                    r.allocs.peak_live_bytes);
         std::printf("\n");
+        if (r.counters.available) {
+            PrintCounterLine(r.counters, r.bytes_per_iteration);
+        }
     }
 }
 
 inline void
 PrintCSVReport(const std::vector<BenchResult>& results)
 {
-    std::printf("benchmark,mean_ns,median_ns,min_ns,max_ns,stddev_ns,p95_ns,p99_ns,iterations,bytes_per_iter,throughput_mb_s\n");
+    const bool counters = HasCounters(results);
+    std::printf("benchmark,mean_ns,median_ns,min_ns,max_ns,stddev_ns,p95_ns,p99_ns,iterations,bytes_per_iter,throughput_mb_s,allocs_per_iter,alloc_bytes_per_iter,peak_live_bytes");
+    if (counters) {
+        for (int i = 0; i < kCounterKinds; ++i) {
+            std::printf(",%s_per_iter", kCounterNames[i]);
+        }
+        std::printf(",ipc,cycles_per_byte,instructions_per_byte");
+    }
+    std::printf("\n");
     for (const auto& r : results) {
         // Sanitize benchmark name by replacing commas with semicolons to avoid CSV issues
         std::string safe_name = r.name;
         for (std::size_t i = 0; i < safe_name.size(); ++i) {
             if (safe_name[i] == ',') safe_name[i] = ';';
         }
-        std::printf("%s,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%zu,%zu,%.2f\n",
+        std::printf("%s,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%zu,%zu,%.2f,%.2f,%.0f,%.0f",
                     safe_name.c_str(),
                     r.stats.mean_ns,
                     r.stats.median_ns,
@@ -191,7 +527,29 @@ PrintCSVReport(const std::vector<BenchResult>& results)
                     r.stats.p99_ns,
                     r.iterations,
                     r.bytes_per_iteration,
-                    r.throughput_mb_s);
+                    r.throughput_mb_s,
+                    r.allocs.allocs_per_iteration,
+                    r.allocs.bytes_per_iteration,
+                    r.allocs.peak_live_bytes);
+        if (counters) {
+            // Counters that were not collected are left empty.
+            double values[kCounterKinds + 3];
+            for (int i = 0; i < kCounterKinds; ++i) {
+                values[i] = r.counters.per_iteration[i];
+            }
+            values[kCounterKinds] = InstructionsPerCycle(r.counters);
+            values[kCounterKinds + 1] = CounterPerByte(r.counters, kCycles, r.bytes_per_iteration);
+            values[kCounterKinds + 2] =
+              CounterPerByte(r.counters, kInstructions, r.bytes_per_iteration);
+            for (int i = 0; i < kCounterKinds + 3; ++i) {
+                if (values[i] < 0) {
+                    std::printf(",");
+                } else {
+                    std::printf(",%.4f", values[i]);
+                }
+            }
+        }
+        std::printf("\n");
     }
 }
 
@@ -218,7 +576,34 @@ PrintJSONReport(const std::vector<BenchResult>& results, const BenchConfig& conf
         std::printf("      \"p99_ns\": %.2f,\n", r.stats.p99_ns);
         std::printf("      \"iterations\": %zu,\n", r.iterations);
         std::printf("      \"bytes_per_iteration\": %zu,\n", r.bytes_per_iteration);
-        std::printf("      \"throughput_mb_s\": %.2f\n", r.throughput_mb_s);
+        std::printf("      \"throughput_mb_s\": %.2f,\n", r.throughput_mb_s);
+        std::printf("      \"allocs_per_iteration\": %.2f,\n", r.allocs.allocs_per_iteration);
+        std::printf("      \"alloc_bytes_per_iteration\": %.0f,\n", r.allocs.bytes_per_iteration);
+        std::printf("      \"peak_live_bytes\": %.0f%s\n",
+                    r.allocs.peak_live_bytes,
+                    r.counters.available ? "," : "");
+        if (r.counters.available) {
+            std::printf("      \"counters\": {");
+            for (int i = 0; i < kCounterKinds; ++i) {
+                std::printf("%s\"%s\": ", i ? ", " : "", kCounterNames[i]);
+                if (r.counters.per_iteration[i] < 0) {
+                    std::printf("null");
+                } else {
+                    std::printf("%.2f", r.counters.per_iteration[i]);
+                }
+            }
+            const double per_byte[2] = {
+                CounterPerByte(r.counters, kCycles, r.bytes_per_iteration),
+                CounterPerByte(r.counters, kInstructions, r.bytes_per_iteration)
+            };
+            const char* const per_byte_names[2] = { "cycles_per_byte", "instructions_per_byte" };
+            for (int i = 0; i < 2; ++i) {
+                if (per_byte[i] >= 0) {
+                    std::printf(", \"%s\": %.4f", per_byte_names[i], per_byte[i]);
+                }
+            }
+            std::printf("}\n");
+        }
         std::printf("    }%s\n", (i < results.size() - 1) ? "," : "");
     }
     std::printf("  ]\n");
@@ -235,8 +620,8 @@ PrintMarkdownReport(const std::vector<BenchResult>& results, const BenchConfig&
     std::printf("- Scale factor: %.2f\n\n", config.scale);
     
     std::printf("## Results\n\n");
-    std::printf("| Benchmark | Mean (ns) | Median (ns) | Min (ns) | Max (ns) | StdDev (ns) | P95 (ns) | P99 (ns) | Throughput (MB/s) |\n");
-    std::printf("|-----------|-----------|-------------|----------|----------|-------------|----------|----------|-------------------|\n");
+    std::printf("| Benchmark | Mean (ns) | Median (ns) | Min (ns) | Max (ns) | StdDev (ns) | P95 (ns) | P99 (ns) | Throughput (MB/s) | Allocs/iter | Bytes/iter | Peak live (B) |\n");
+    std::printf("|-----------|-----------|-------------|----------|----------|-------------|----------|----------|-------------------|-------------|------------|---------------|\n");
     
     for (const auto& r : results) {
         std::printf("| %s | %.2f | %.2f | %.2f | %.2f | %.2f | %.2f | %.2f | ",
@@ -253,17 +638,383 @@ PrintMarkdownReport(const std::vector<BenchResult>& results, const BenchConfig&
         } else {
             std::printf("N/A");
         }
+        std::printf(" | %.1f | %.0f | %.0f |\n",
+                    r.allocs.allocs_per_iteration,
+                    r.allocs.bytes_per_iteration,
+                    r.allocs.peak_live_bytes);
+    }
+    std::printf("\n");
+
+    if (!HasCounters(results)) {
+        return;
+    }
+    std::printf("## Hardware Counters (per iteration)\n\n");
+    std::printf("| Benchmark | Cycles | Instructions | IPC | Branch misses | L1D misses | LLC misses | Cycles/byte | Instructions/byte |\n");
+    std::printf("|-----------|--------|--------------|-----|---------------|------------|------------|-------------|-------------------|\n");
+    for (const auto& r : results) {
+        std::printf("| %s", r.name.c_str());
+        for (int i = 0; i < kCounterKinds; ++i) {
+            std::printf(" | ");
+            PrintCounterValue("%.0f", r.counters.per_iteration[i]);
+            if (i == kInstructions) {
+                std::printf(" | ");
+                PrintCounterValue("%.2f", InstructionsPerCycle(r.counters));
+            }
+        }
+        std::printf(" | ");
+        PrintCounterValue("%.2f", CounterPerByte(r.counters, kCycles, r.bytes_per_iteration));
+        std::printf(" | ");
+        PrintCounterValue("%.2f", CounterPerByte(r.counters, kInstructions, r.bytes_per_iteration));
         std::printf(" |\n");
     }
     std::printf("\n");
 }
 
 
+// The same operation run through json.cpp and through another library.
+struct ComparisonCase
+{
+    std::string name;
+    std::size_t inner_iterations;
+    std::size_t bytes_per_iteration;
+    std::function<void()> ours;
+    std::function<void()> theirs;
+};
+
+// Prints one row per operation from results stored in pairs, ours then
+// theirs. Ratios above 1 mean json.cpp is faster or allocates less.
+inline void
+PrintComparisonReport(const std::vector<BenchResult>& results,
+                      const std::string& library,
+                      const std::string& format)
+{
+    const bool csv = format == "csv";
+    const bool json = format == "json";
+    const bool markdown = format == "markdown" || format == "md";
+    if (csv) {
+        std::printf("benchmark,library,jt_median_ns,other_median_ns,speedup,jt_mb_s,other_mb_s,"
+                    "jt_allocs_per_iter,other_allocs_per_iter,jt_peak_live_bytes,other_peak_live_bytes\n");
+    } else if (json) {
+        std::printf("{\n  \"library\": \"%s\",\n  \"comparisons\": [\n", library.c_str());
+    } else if (markdown) {
+        std::printf("## json.cpp vs %s\n\n", library.c_str());
+        std::printf("| Benchmark | jt median (ns) | %s median (ns) | Speedup | jt allocs/iter | %s allocs/iter | jt peak (B) | %s peak (B) |\n",
+                    library.c_str(), library.c_str(), library.c_str());
+        std::printf("|-----------|----------------|------------------|---------|----------------|------------------|-------------|---------------|\n");
+    } else {
+        std::printf("\n=== json.cpp vs %s ===\n", library.c_str());
+        std::printf("%-28s %14s %14s %8s %12s %12s %12s %12s\n",
+                    "benchmark", "jt ns", "other ns", "speedup",
+                    "jt allocs", "other allocs", "jt peak", "other peak");
+    }
+    for (std::size_t i = 0; i + 1 < results.size(); i += 2) {
+        const BenchResult& ours = results[i];
+        const BenchResult& theirs = results[i + 1];
+        std::string name = ours.name.substr(0, ours.name.rfind('/'));
+        double speedup = ours.stats.median_ns > 0 ? theirs.stats.median_ns / ours.stats.median_ns : 0.0;
+        if (csv) {
+            std::printf("%s,%s,%.2f,%.2f,%.3f,%.2f,%.2f,%.1f,%.1f,%.0f,%.0f\n",
+                        name.c_str(),
+                        library.c_str(),
+                        ours.stats.median_ns,
+                        theirs.stats.median_ns,
+                        speedup,
+                        ours.throughput_mb_s,
+                        theirs.throughput_mb_s,
+                        ours.allocs.allocs_per_iteration,
+                        theirs.allocs.allocs_per_iteration,
+                        ours.allocs.peak_live_bytes,
+                        theirs.allocs.peak_live_bytes);
+        } else if (json) {
+            std::printf("    {\"name\": \"%s\", \"jt_median_ns\": %.2f, \"other_median_ns\": %.2f, "
+                        "\"speedup\": %.3f, \"jt_mb_s\": %.2f, \"other_mb_s\": %.2f, "
+                        "\"jt_allocs_per_iteration\": %.1f, \"other_allocs_per_iteration\": %.1f, "
+                        "\"jt_peak_live_bytes\": %.0f, \"other_peak_live_bytes\": %.0f}%s\n",
+                        name.c_str(),
+                        ours.stats.median_ns,
+                        theirs.stats.median_ns,
+                        speedup,
+                        ours.throughput_mb_s,
+                        theirs.throughput_mb_s,
+                        ours.allocs.allocs_per_iteration,
+                        theirs.allocs.allocs_per_iteration,
+                        ours.allocs.peak_live_bytes,
+                        theirs.allocs.peak_live_bytes,
+                        i + 2 < results.size() ? "," : "");
+        } else if (markdown) {
+            std::printf("| %s | %.2f | %.2f | %.2fx | %.1f | %.1f | %.0f | %.0f |\n",
+                        name.c_str(),
+                        ours.stats.median_ns,
+                        theirs.stats.median_ns,
+                        speedup,
+                        ours.allocs.allocs_per_iteration,
+                        theirs.allocs.allocs_per_iteration,
+                        ours.allocs.peak_live_bytes,
+                        theirs.allocs.peak_live_bytes);
+        } else {
+            std::printf("%-28s %14.2f %14.2f %7.2fx %12.1f %12.1f %12.0f %12.0f\n",
+                        name.c_str(),
+                        ours.stats.median_ns,
+                        theirs.stats.median_ns,
+                        speedup,
+                        ours.allocs.allocs_per_iteration,
+                        theirs.allocs.allocs_per_iteration,
+                        ours.allocs.peak_live_bytes,
+                        theirs.allocs.peak_live_bytes);
+        }
+    }
+    if (json) {
+        std::printf("  ]\n}\n");
+    } else if (markdown) {
+        std::printf("\n");
+    }
+}
+
+// Log-linear latency histogram in the style of HdrHistogram. Values
+// below 2 * kLatencySubBuckets nanoseconds are exact; above that each
+// power of two is split into kLatencySubBuckets slots, so a recorded
+// value is off by less than 1 / kLatencySubBuckets (0.8%).
+static const int kLatencySubBits = 7;
+static const std::size_t kLatencySubBuckets = std::size_t(1) << kLatencySubBits;
+
+class LatencyHistogram
+{
+  public:
+    LatencyHistogram()
+      : counts_(2 * kLatencySubBuckets + (63 - kLatencySubBits) * kLatencySubBuckets),
+        total_(0),
+        min_(~std::uint64_t(0)),
+        max_(0),
+        sum_(0)
+    {
+    }
+
+    void record(std::uint64_t ns)
+    {
+        ++counts_[indexOf(ns)];
+        ++total_;
+        min_ = std::min(min_, ns);
+        max_ = std::max(max_, ns);
+        sum_ += static_cast<double>(ns);
+    }
+
+    // Highest value that falls in the same slot as the requested rank,
+    // capped at the exact maximum.
+    std::uint64_t percentile(double pct) const
+    {
+        if (!total_) {
+            return 0;
+        }
+        std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(pct / 100.0 * total_));
+        rank = std::max<std::uint64_t>(1, std::min(rank, total_));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(highestIn(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    std::uint64_t countAbove(std::uint64_t ns) const
+    {
+        std::uint64_t count = 0;
+        for (std::size_t i = indexOf(ns) + 1; i < counts_.size(); ++i) {
+            count += counts_[i];
+        }
+        return count;
+    }
+
+    std::uint64_t total() const
+    {
+        return total_;
+    }
+
+    std::uint64_t min() const
+    {
+        return total_ ? min_ : 0;
+    }
+
+    std::uint64_t max() const
+    {
+        return max_;
+    }
+
+    double mean() const
+    {
+        return total_ ? sum_ / total_ : 0.0;
+    }
+
+  private:
+    std::vector<std::uint64_t> counts_;
+    std::uint64_t total_;
+    std::uint64_t min_;
+    std::uint64_t max_;
+    double sum_;
+
+    static std::size_t indexOf(std::uint64_t ns)
+    {
+        if (ns < 2 * kLatencySubBuckets) {
+            return static_cast<std::size_t>(ns);
+        }
+        int msb = 63 - __builtin_clzll(ns);
+        int shift = msb - kLatencySubBits;
+        std::size_t sub = static_cast<std::size_t>(ns >> shift) - kLatencySubBuckets;
+        return 2 * kLatencySubBuckets + (shift - 1) * kLatencySubBuckets + sub;
+    }
+
+    static std::uint64_t highestIn(std::size_t index)
+    {
+        if (index < 2 * kLatencySubBuckets) {
+            return index;
+        }
+        std::size_t rest = index - 2 * kLatencySubBuckets;
+        int shift = static_cast<int>(rest / kLatencySubBuckets) + 1;
+        std::uint64_t sub = rest % kLatencySubBuckets + kLatencySubBuckets;
+        return ((sub + 1) << shift) - 1;
+    }
+};
+
+// A single operation slower than this many medians counts as an
+// outlier, which is usually an allocator refill or a page fault.
+static const std::uint64_t kOutlierFactor = 10;
+
+struct LatencyResult
+{
+    std::string name;
+    std::uint64_t count;
+    double mean_ns;
+    std::uint64_t min_ns;
+    std::uint64_t p50_ns;
+    std::uint64_t p90_ns;
+    std::uint64_t p99_ns;
+    std::uint64_t p999_ns;
+    std::uint64_t max_ns;
+    std::uint64_t outliers;
+};
+
+inline std::uint64_t
+MonotonicNanos()
+{
+    return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+        .count());
+}
+
+// Smallest back-to-back difference of the clock, subtracted from every
+// sample so very short operations are not dominated by timer cost.
+inline std::uint64_t
+TimerOverheadNanos()
+{
+    std::uint64_t best = ~std::uint64_t(0);
+    for (int i = 0; i < 1000; ++i) {
+        std::uint64_t a = MonotonicNanos();
+        std::uint64_t b = MonotonicNanos();
+        best = std::min(best, b - a);
+    }
+    return best;
+}
+
+inline LatencyResult
+SummarizeLatency(const std::string& name, const LatencyHistogram& histogram)
+{
+    LatencyResult result;
+    result.name = name;
+    result.count = histogram.total();
+    result.mean_ns = histogram.mean();
+    result.min_ns = histogram.min();
+    result.p50_ns = histogram.percentile(50.0);
+    result.p90_ns = histogram.percentile(90.0);
+    result.p99_ns = histogram.percentile(99.0);
+    result.p999_ns = histogram.percentile(99.9);
+    result.max_ns = histogram.max();
+    result.outliers = histogram.countAbove(result.p50_ns * kOutlierFactor);
+    return result;
+}
+
+inline void
+PrintLatencyReport(const std::vector<LatencyResult>& results,
+                   const std::string& format,
+                   std::uint64_t timer_overhead_ns)
+{
+    if (format == "csv") {
+        std::printf("benchmark,count,mean_ns,min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,outliers\n");
+        for (const auto& r : results) {
+            std::printf("%s,%llu,%.1f,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                        r.name.c_str(),
+                        static_cast<unsigned long long>(r.count),
+                        r.mean_ns,
+                        static_cast<unsigned long long>(r.min_ns),
+                        static_cast<unsigned long long>(r.p50_ns),
+                        static_cast<unsigned long long>(r.p90_ns),
+                        static_cast<unsigned long long>(r.p99_ns),
+                        static_cast<unsigned long long>(r.p999_ns),
+                        static_cast<unsigned long long>(r.max_ns),
+                        static_cast<unsigned long long>(r.outliers));
+        }
+    } else if (format == "json") {
+        std::printf("{\n  \"timer_overhead_ns\": %llu,\n  \"latency\": [\n",
+                    static_cast<unsigned long long>(timer_overhead_ns));
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            const LatencyResult& r = results[i];
+            std::printf("    {\"name\": \"%s\", \"count\": %llu, \"mean_ns\": %.1f, \"min_ns\": %llu, "
+                        "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+                        "\"max_ns\": %llu, \"outliers\": %llu}%s\n",
+                        r.name.c_str(),
+                        static_cast<unsigned long long>(r.count),
+                        r.mean_ns,
+                        static_cast<unsigned long long>(r.min_ns),
+                        static_cast<unsigned long long>(r.p50_ns),
+                        static_cast<unsigned long long>(r.p90_ns),
+                        static_cast<unsigned long long>(r.p99_ns),
+                        static_cast<unsigned long long>(r.p999_ns),
+                        static_cast<unsigned long long>(r.max_ns),
+                        static_cast<unsigned long long>(r.outliers),
+                        i + 1 < results.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    } else {
+        const bool markdown = format == "markdown" || format == "md";
+        if (markdown) {
+            std::printf("## Per-operation Latency\n\n");
+            std::printf("Timer overhead: %llu ns (subtracted)\n\n",
+                        static_cast<unsigned long long>(timer_overhead_ns));
+            std::printf("| Benchmark | Count | p50 (ns) | p90 (ns) | p99 (ns) | p99.9 (ns) | Max (ns) | Outliers |\n");
+            std::printf("|-----------|-------|----------|----------|----------|------------|----------|----------|\n");
+        } else {
+            std::printf("\n=== Per-operation latency (timer overhead %llu ns subtracted) ===\n",
+                        static_cast<unsigned long long>(timer_overhead_ns));
+        }
+        for (const auto& r : results) {
+            std::printf(markdown ? "| %s | %llu | %llu | %llu | %llu | %llu | %llu | %llu |\n"
+                                 : "%-32s n=%-8llu p50=%-10llu p90=%-10llu p99=%-10llu "
+                                   "p99.9=%-10llu max=%-12llu outliers=%llu\n",
+                        r.name.c_str(),
+                        static_cast<unsigned long long>(r.count),
+                        static_cast<unsigned long long>(r.p50_ns),
+                        static_cast<unsigned long long>(r.p90_ns),
+                        static_cast<unsigned long long>(r.p99_ns),
+                        static_cast<unsigned long long>(r.p999_ns),
+                        static_cast<unsigned long long>(r.max_ns),
+                        static_cast<unsigned long long>(r.outliers));
+        }
+    }
+}
+
 class Runner
 {
   public:
-    explicit Runner(const BenchConfig& cfg) : config_(cfg)
+    explicit Runner(const BenchConfig& cfg) : config_(cfg), counters_enabled_(false)
     {
+        if (config_.counters && !config_.list_only) {
+            std::string error;
+            counters_enabled_ = counters_.open(error);
+            if (!counters_enabled_) {
+                std::fprintf(stderr, "json_perf: counters disabled: %s\n", error.c_str());
+            }
+        }
     }
 
     void run(const BenchCase& bench_case)
@@ -281,6 +1032,11 @@ class Runner
             return;
         }
 
+        if (config_.latency) {
+            runLatency(bench_case, inner);
+            return;
+        }
+
         // Warmup runs
         for (std::size_t w = 0; w < config_.warmup_runs; ++w) {
             if (bench_case.prepare) {
@@ -298,11 +1054,17 @@ class Runner
             if (bench_case.prepare) {
                 bench_case.prepare(inner);
             }
+            if (counters_enabled_) {
+                counters_.start();
+            }
             Clock::time_point start = Clock::now();
             for (std::size_t i = 0; i < inner; ++i) {
                 bench_case.body();
             }
             Clock::time_point end = Clock::now();
+            if (counters_enabled_) {
+                counters_.stop();
+            }
             double total_ns = static_cast<double>(
               std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
                 .count());
@@ -311,6 +1073,11 @@ class Runner
         }
 
         Stats stats = ComputeStats(samples);
+        CounterStats counters;
+        if (counters_enabled_) {
+            counters = counters_.take(inner * config_.measure_runs);
+        }
+        AllocStats allocs = measureAllocations(bench_case, inner);
 
         double throughput_mb_s = 0.0;
         if (bench_case.bytes_per_iteration > 0 && stats.median_ns > 0.0) {
@@ -323,93 +1090,1788 @@ class Runner
         result.iterations = inner;
         result.bytes_per_iteration = bench_case.bytes_per_iteration;
         result.throughput_mb_s = throughput_mb_s;
+        result.allocs = allocs;
+        result.counters = counters;
         results_.push_back(result);
 
-        if (!config_.generate_report) {
-            std::printf("%-32s %10.2f ns/op  (median %.2f | min %.2f | max %.2f | stddev %.2f)  inner=%-6zu",
-                        bench_case.name.c_str(),
-                        stats.mean_ns,
-                        stats.median_ns,
-                        stats.min_ns,
-                        stats.max_ns,
-                        stats.stddev_ns,
-                        inner);
-            if (throughput_mb_s > 0.0) {
-                std::printf("  throughput=%.2f MB/s",
-                            throughput_mb_s);
+        if (!config_.generate_report) {
+            std::printf("%-32s %10.2f ns/op  (median %.2f | min %.2f | max %.2f | stddev %.2f)  inner=%-6zu",
+                        bench_case.name.c_str(),
+                        stats.mean_ns,
+                        stats.median_ns,
+                        stats.min_ns,
+                        stats.max_ns,
+                        stats.stddev_ns,
+                        inner);
+            if (throughput_mb_s > 0.0) {
+                std::printf("  throughput=%.2f MB/s",
+                            throughput_mb_s);
+            }
+            std::printf("  allocs=%.1f bytes=%.0f peak=%.0f",
+                        allocs.allocs_per_iteration,
+                        allocs.bytes_per_iteration,
+                        allocs.peak_live_bytes);
+            std::printf("\n");
+            if (counters.available) {
+                PrintCounterLine(counters, bench_case.bytes_per_iteration);
+            }
+        }
+    }
+
+    const std::vector<BenchResult>& getResults() const
+    {
+        return results_;
+    }
+
+    const std::vector<LatencyResult>& getLatencyResults() const
+    {
+        return latency_results_;
+    }
+
+    std::uint64_t timerOverhead() const
+    {
+        return timer_overhead_ns_;
+    }
+
+  private:
+    BenchConfig config_;
+    std::vector<BenchResult> results_;
+    PerfCounters counters_;
+    bool counters_enabled_;
+    std::vector<LatencyResult> latency_results_;
+    std::uint64_t timer_overhead_ns_ = 0;
+
+    // Times every call of the body on its own instead of a whole batch,
+    // so a single slow parse shows up in the tail instead of being
+    // averaged into its batch.
+    void runLatency(const BenchCase& bench_case, std::size_t inner)
+    {
+        if (!timer_overhead_ns_) {
+            timer_overhead_ns_ = TimerOverheadNanos();
+        }
+        for (std::size_t w = 0; w < config_.warmup_runs; ++w) {
+            if (bench_case.prepare) {
+                bench_case.prepare(inner);
+            }
+            for (std::size_t i = 0; i < inner; ++i) {
+                bench_case.body();
+            }
+        }
+        LatencyHistogram histogram;
+        for (std::size_t run = 0; run < config_.measure_runs; ++run) {
+            if (bench_case.prepare) {
+                bench_case.prepare(inner);
+            }
+            for (std::size_t i = 0; i < inner; ++i) {
+                std::uint64_t start = MonotonicNanos();
+                bench_case.body();
+                std::uint64_t elapsed = MonotonicNanos() - start;
+                histogram.record(elapsed > timer_overhead_ns_ ? elapsed - timer_overhead_ns_ : 0);
+            }
+        }
+        LatencyResult result = SummarizeLatency(bench_case.name, histogram);
+        latency_results_.push_back(result);
+        if (!config_.generate_report) {
+            std::printf("%-32s p50=%llu ns  p99=%llu ns  p99.9=%llu ns  max=%llu ns  (n=%llu)\n",
+                        result.name.c_str(),
+                        static_cast<unsigned long long>(result.p50_ns),
+                        static_cast<unsigned long long>(result.p99_ns),
+                        static_cast<unsigned long long>(result.p999_ns),
+                        static_cast<unsigned long long>(result.max_ns),
+                        static_cast<unsigned long long>(result.count));
+        }
+    }
+
+    // Runs the body once more with the allocation hooks counting. Peak
+    // live bytes is the largest net growth seen within one iteration.
+    AllocStats measureAllocations(const BenchCase& bench_case, std::size_t inner)
+    {
+        if (bench_case.prepare) {
+            bench_case.prepare(inner);
+        }
+        std::int64_t peak = 0;
+        g_alloc_count.store(0, std::memory_order_relaxed);
+        g_alloc_bytes.store(0, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < inner; ++i) {
+            g_alloc_live.store(0, std::memory_order_relaxed);
+            g_alloc_peak.store(0, std::memory_order_relaxed);
+            g_alloc_tracking.store(true, std::memory_order_relaxed);
+            bench_case.body();
+            g_alloc_tracking.store(false, std::memory_order_relaxed);
+            peak = std::max(peak, g_alloc_peak.load(std::memory_order_relaxed));
+        }
+        AllocStats allocs;
+        allocs.allocs_per_iteration =
+          static_cast<double>(g_alloc_count.load(std::memory_order_relaxed)) / inner;
+        allocs.bytes_per_iteration =
+          static_cast<double>(g_alloc_bytes.load(std::memory_order_relaxed)) / inner;
+        allocs.peak_live_bytes = static_cast<double>(peak);
+        return allocs;
+    }
+};
+
+inline std::string
+ReadTextFile(const std::string& path)
+{
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    Ensure(file.good(), std::string("unable to open file: ") + path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+struct Corpus
+{
+    std::string name;
+    std::vector<std::string> files;
+    std::size_t total_bytes;
+};
+
+inline bool
+HasPrefix(const std::string& s, const std::string& prefix)
+{
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+inline Corpus
+LoadCorpus(const std::string& dir, const std::string& prefix, std::size_t limit)
+{
+    Corpus corpus;
+    corpus.total_bytes = 0;
+    DIR* handle = opendir(dir.c_str());
+    Ensure(handle != NULL, std::string("unable to open directory: ") + dir);
+    std::vector<std::string> paths;
+    struct dirent* entry;
+    while ((entry = readdir(handle)) != NULL) {
+        const char* name = entry->d_name;
+        if (name[0] == '.') {
+            continue;
+        }
+        std::string filename(name);
+        if (!prefix.empty() && !HasPrefix(filename, prefix)) {
+            continue;
+        }
+        std::string path = dir + "/" + filename;
+        paths.push_back(path);
+    }
+    closedir(handle);
+
+    std::sort(paths.begin(), paths.end());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        if (limit > 0 && corpus.files.size() >= limit) {
+            break;
+        }
+        const std::string& path = paths[i];
+        std::string contents = ReadTextFile(path);
+        corpus.total_bytes += contents.size();
+        corpus.files.push_back(contents);
+    }
+    corpus.name = dir;
+    return corpus;
+}
+
+// Deterministic document generators. The PRNG and every formatting
+// choice are spelled out here rather than taken from <random>, so a
+// given seed and size produce the same bytes on every platform.
+class Random
+{
+  public:
+    explicit Random(std::uint64_t seed) : state_(seed)
+    {
+    }
+
+    std::uint64_t next()
+    {
+        // splitmix64
+        std::uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    std::size_t below(std::size_t n)
+    {
+        return static_cast<std::size_t>(next() % n);
+    }
+
+    double uniform(double lo, double hi)
+    {
+        return lo + (hi - lo) * (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+  private:
+    std::uint64_t state_;
+};
+
+enum Shape
+{
+    kCanada,
+    kTwitter,
+    kWide,
+    kDeep,
+    kEscapes,
+    kShapes
+};
+
+static const char* const kShapeNames[kShapes] = { "canada", "twitter", "wide", "deep", "escapes" };
+
+// Deep documents stay this many levels below the parser's nesting limit.
+static const int kDeepLevels = 18;
+
+inline void
+AppendDouble(std::string& out, double value, int digits)
+{
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.*f", digits, value);
+    out += buf;
+}
+
+inline void
+AppendLong(std::string& out, long long value)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%lld", value);
+    out += buf;
+}
+
+// GeoJSON polygons with long runs of coordinate pairs, like canada.json.
+inline void
+GenerateCanada(std::string& out, std::size_t bytes, Random& rng)
+{
+    out += "{\"type\":\"FeatureCollection\",\"features\":[";
+    for (std::size_t f = 0; f == 0 || out.size() < bytes; ++f) {
+        if (f) {
+            out += ',';
+        }
+        out += "{\"type\":\"Feature\",\"properties\":{\"name\":\"region-";
+        AppendLong(out, f);
+        out += "\"},\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[[";
+        double x = rng.uniform(-141.0, -52.0);
+        double y = rng.uniform(41.0, 83.0);
+        std::size_t points = 64 + rng.below(192);
+        for (std::size_t i = 0; i < points; ++i) {
+            x += rng.uniform(-0.01, 0.01);
+            y += rng.uniform(-0.01, 0.01);
+            out += i ? ",[" : "[";
+            AppendDouble(out, x, 14);
+            out += ',';
+            AppendDouble(out, y, 14);
+            out += ']';
+        }
+        out += "]]}}";
+    }
+    out += "]}";
+}
+
+// Social media records mixing ASCII, accented Latin, CJK, emoji and
+// escaped surrogate pairs.
+inline void
+GenerateTwitter(std::string& out, std::size_t bytes, Random& rng)
+{
+    static const char* const kWords[] = {
+        "hello", "json", "parser", "caf\xc3\xa9", "na\xc3\xafve", "\xe6\x9d\xb1\xe4\xba\xac",
+        "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", "\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4",
+        "\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82", "\xf0\x9f\x98\x80",
+        "\xf0\x9f\x9a\x80", "\\ud83d\\udc4d", "\\u00e9t\\u00e9", "#perf", "@user"
+    };
+    static const char* const kLangs[] = { "en", "ja", "ko", "ru", "fr" };
+    const std::size_t words = sizeof(kWords) / sizeof(kWords[0]);
+    out += "{\"statuses\":[";
+    for (std::size_t s = 0; s == 0 || out.size() < bytes; ++s) {
+        if (s) {
+            out += ',';
+        }
+        out += "{\"id\":";
+        AppendLong(out, 500000000000000000LL + static_cast<long long>(s));
+        out += ",\"text\":\"";
+        std::size_t count = 8 + rng.below(24);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (i) {
+                out += ' ';
+            }
+            out += kWords[rng.below(words)];
+        }
+        out += "\",\"lang\":\"";
+        out += kLangs[rng.below(5)];
+        out += "\",\"retweet_count\":";
+        AppendLong(out, static_cast<long long>(rng.below(100)));
+        out += ",\"favorited\":";
+        out += rng.below(2) ? "true" : "false";
+        out += ",\"user\":{\"screen_name\":\"user_";
+        AppendLong(out, static_cast<long long>(rng.below(10000)));
+        out += "\",\"followers_count\":";
+        AppendLong(out, static_cast<long long>(rng.below(1000000)));
+        out += "},\"entities\":{\"hashtags\":[";
+        std::size_t tags = rng.below(4);
+        for (std::size_t i = 0; i < tags; ++i) {
+            out += i ? ",\"" : "\"";
+            out += kWords[rng.below(words)];
+            out += '"';
+        }
+        out += "]}}";
+    }
+    out += "]}";
+}
+
+// Rows with a thousand keys each, stressing key parsing and map inserts.
+inline void
+GenerateWide(std::string& out, std::size_t bytes, Random& rng)
+{
+    out += "{\"rows\":[";
+    for (std::size_t r = 0; r == 0 || out.size() < bytes; ++r) {
+        out += r ? ",{" : "{";
+        for (int k = 0; k < 1000; ++k) {
+            char key[16];
+            std::snprintf(key, sizeof(key), "%s\"k%04d\":", k ? "," : "", k);
+            out += key;
+            switch (rng.below(4)) {
+                case 0:
+                    AppendLong(out, static_cast<long long>(rng.below(1000000)));
+                    break;
+                case 1:
+                    AppendDouble(out, rng.uniform(0, 1000), 3);
+                    break;
+                case 2:
+                    out += rng.below(2) ? "true" : "null";
+                    break;
+                default:
+                    out += "\"v";
+                    AppendLong(out, static_cast<long long>(rng.below(1000)));
+                    out += '"';
+                    break;
+            }
+        }
+        out += '}';
+    }
+    out += "]}";
+}
+
+// Many chains of alternating objects and arrays, each kDeepLevels deep
+// and ending in a leaf object.
+inline void
+GenerateDeep(std::string& out, std::size_t bytes, Random& rng)
+{
+    out += "{\"items\":[";
+    for (std::size_t c = 0; c == 0 || out.size() < bytes; ++c) {
+        if (c) {
+            out += ',';
+        }
+        int levels = kDeepLevels - 3 - static_cast<int>(rng.below(4));
+        for (int i = 0; i < levels; ++i) {
+            out += (i & 1) ? "[" : "{\"n\":";
+        }
+        out += "{\"leaf\":";
+        AppendLong(out, static_cast<long long>(c));
+        out += '}';
+        for (int i = levels - 1; i >= 0; --i) {
+            out += (i & 1) ? "]" : "}";
+        }
+    }
+    out += "]}";
+}
+
+// Strings dense with quotes, backslashes, control escapes and \u forms.
+inline void
+GenerateEscapes(std::string& out, std::size_t bytes, Random& rng)
+{
+    static const char* const kPieces[] = {
+        "\\\"", "\\\\", "\\/", "\\b", "\\f", "\\n", "\\r", "\\t",
+        "\\u0001", "\\u001f", "\\u00e9", "\\u2028", "C:\\\\path\\\\to", "plain"
+    };
+    const std::size_t pieces = sizeof(kPieces) / sizeof(kPieces[0]);
+    out += '[';
+    for (std::size_t r = 0; r == 0 || out.size() < bytes; ++r) {
+        out += r ? ",{\"text\":\"" : "{\"text\":\"";
+        std::size_t count = 16 + rng.below(48);
+        for (std::size_t i = 0; i < count; ++i) {
+            out += kPieces[rng.below(pieces)];
+        }
+        out += "\",\"id\":";
+        AppendLong(out, static_cast<long long>(r));
+        out += '}';
+    }
+    out += ']';
+}
+
+// Returns a document of the given shape that is at least `bytes` long,
+// overshooting by at most one record.
+inline std::string
+GenerateShape(Shape shape, std::size_t bytes, std::uint64_t seed)
+{
+    Random rng(seed ^ (static_cast<std::uint64_t>(shape) << 56));
+    std::string out;
+    out.reserve(bytes + 4096);
+    switch (shape) {
+        case kCanada:
+            GenerateCanada(out, bytes, rng);
+            break;
+        case kTwitter:
+            GenerateTwitter(out, bytes, rng);
+            break;
+        case kWide:
+            GenerateWide(out, bytes, rng);
+            break;
+        case kDeep:
+            GenerateDeep(out, bytes, rng);
+            break;
+        default:
+            GenerateEscapes(out, bytes, rng);
+            break;
+    }
+    return out;
+}
+
+// JSONPath suite on the generated twitter document. Each expression
+// leans on one step kind, filter operator or function so a regression
+// in that engine path shows up as its own case.
+struct JsonPathSuiteCase
+{
+    const char* name;
+    const char* path;
+};
+
+static const JsonPathSuiteCase kJsonPathSuite[] = {
+    { "name", "$.statuses[*].user.screen_name" },
+    { "wildcard", "$.statuses[*].*" },
+    { "indices", "$.statuses[*].entities.hashtags[0]" },
+    { "slice", "$.statuses[1:-1:3].id" },
+    { "union", "$.statuses[*]['id','lang','retweet_count']" },
+    { "recursive_name", "$..screen_name" },
+    { "recursive_wildcard", "$..*" },
+    { "recursive_filter", "$..[?(@.followers_count > 500000)]" },
+    { "filter_exists", "$.statuses[?(@.entities.hashtags[1])].id" },
+    { "filter_eq", "$.statuses[?(@.lang == 'ru')].id" },
+    { "filter_ne", "$.statuses[?(@.lang != 'ru')].id" },
+    { "filter_lt", "$.statuses[?(@.retweet_count < 50)].id" },
+    { "filter_le", "$.statuses[?(@.retweet_count <= 50)].id" },
+    { "filter_gt", "$.statuses[?(@.retweet_count > 50)].id" },
+    { "filter_ge", "$.statuses[?(@.retweet_count >= 50)].id" },
+    { "filter_regex", "$.statuses[?(@.user.screen_name =~ 'user_1.*')].id" },
+    { "filter_and", "$.statuses[?(@.retweet_count > 50 && @.favorited == true)].id" },
+    { "filter_or", "$.statuses[?(@.lang == 'ja' || @.retweet_count > 90)].id" },
+    { "filter_not", "$.statuses[?(!@.favorited)].id" },
+    { "filter_length", "$.statuses[?(length(@.entities.hashtags) > 1)].id" },
+    { "filter_size", "$.statuses[?(size(@.text) > 80)].id" },
+    { "filter_count", "$.statuses[?(count(@.entities.hashtags) >= 2)].id" },
+};
+
+// Distinct expressions rotated through by the cold compile case. More
+// than the per-thread compile cache holds, so every lookup misses.
+static const std::size_t kColdCompilePaths = 256;
+
+// A JSONPath query that touches a realistic slice of each shape.
+inline const char*
+ShapeQuery(Shape shape)
+{
+    switch (shape) {
+        case kCanada:
+            return "$.features[*].geometry.coordinates[0][*][0]";
+        case kTwitter:
+            return "$.statuses[?(@.retweet_count > 90)].user.screen_name";
+        case kWide:
+            return "$.rows[*].k0500";
+        case kDeep:
+            return "$..leaf";
+        default:
+            return "$[?(@.id < 100)].text";
+    }
+}
+
+inline int
+ShapeByName(const std::string& name)
+{
+    for (int i = 0; i < kShapes; ++i) {
+        if (name == kShapeNames[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+inline std::size_t
+ParseSize(const std::string& text)
+{
+    char* end = NULL;
+    double value = std::strtod(text.c_str(), &end);
+    std::string suffix(end);
+    if (suffix == "k" || suffix == "K" || suffix == "KB") {
+        value *= 1024;
+    } else if (suffix == "m" || suffix == "M" || suffix == "MB") {
+        value *= 1024 * 1024;
+    } else if (suffix == "g" || suffix == "G" || suffix == "GB") {
+        value *= 1024.0 * 1024 * 1024;
+    } else {
+        Ensure(suffix.empty(), "bad size: " + text);
+    }
+    Ensure(value >= 1, "bad size: " + text);
+    return static_cast<std::size_t>(value);
+}
+
+// Size sweeps. Each operation runs on generated documents that grow by
+// kSweepFactor from --sweep-min to --sweep-max. The scaling exponent is
+// the least squares slope of log(time) over log(size) across the largest
+// sizes, where fixed costs no longer dominate. Linear work gives about 1.
+enum SweepOp
+{
+    kSweepParse,
+    kSweepStringify,
+    kSweepQuery,
+    kSweepDelete,
+    kSweepOps
+};
+
+static const char* const kSweepOpNames[kSweepOps] = { "parse", "stringify", "jsonpath", "delete" };
+static const std::size_t kSweepFactor = 4;
+static const std::size_t kSweepFitPoints = 4;
+static const double kSuperLinearExponent = 1.15;
+
+// Deletes most of one large container, the pattern that turns quadratic
+// when removals shift the remaining elements one at a time.
+inline const char*
+ShapeDeleteQuery(Shape shape)
+{
+    switch (shape) {
+        case kCanada:
+            return "$.features[*].geometry.coordinates[0][1:]";
+        case kTwitter:
+            return "$.statuses[?(@.retweet_count < 90)]";
+        case kWide:
+            return "$.rows[*][?(@ == null)]";
+        case kDeep:
+            return "$..leaf";
+        default:
+            return "$[?(@.id > 0)]";
+    }
+}
+
+struct SweepPoint
+{
+    std::size_t bytes;
+    double median_ns;
+};
+
+struct SweepSeries
+{
+    std::string name;
+    std::vector<SweepPoint> points;
+    double exponent;
+    bool super_linear;
+};
+
+inline double
+TimeSweepOp(SweepOp op,
+            Shape shape,
+            const std::string& text,
+            const jt::Json& doc,
+            std::size_t reps)
+{
+    std::vector<jt::Json> copies;
+    if (op == kSweepDelete) {
+        copies.assign(reps, doc);
+    }
+    Clock::time_point start = Clock::now();
+    for (std::size_t i = 0; i < reps; ++i) {
+        switch (op) {
+            case kSweepParse: {
+                std::pair<jt::Json::Status, jt::Json> parsed = jt::Json::parse(text);
+                g_sink += parsed.first;
+                break;
+            }
+            case kSweepStringify: {
+                std::string out = doc.toString();
+                g_sink += out.size();
+                break;
+            }
+            case kSweepQuery:
+                g_sink += doc.jsonpath(ShapeQuery(shape)).size();
+                break;
+            default:
+                g_sink += copies[i].deleteJsonpath(ShapeDeleteQuery(shape));
+                break;
+        }
+    }
+    Clock::time_point end = Clock::now();
+    return static_cast<double>(
+             std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) /
+           reps;
+}
+
+inline double
+FitExponent(const std::vector<SweepPoint>& points)
+{
+    std::size_t first = points.size() > kSweepFitPoints ? points.size() - kSweepFitPoints : 0;
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (std::size_t i = first; i < points.size(); ++i) {
+        if (points[i].median_ns <= 0) {
+            continue;
+        }
+        double x = std::log(static_cast<double>(points[i].bytes));
+        double y = std::log(points[i].median_ns);
+        n += 1;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    double denominator = n * sxx - sx * sx;
+    if (n < 2 || denominator == 0) {
+        return 0;
+    }
+    return (n * sxy - sx * sy) / denominator;
+}
+
+inline std::vector<SweepSeries>
+RunSweep(const BenchConfig& config)
+{
+    std::vector<SweepSeries> series;
+    for (int s = 0; s < kShapes; ++s) {
+        for (int op = 0; op < kSweepOps; ++op) {
+            SweepSeries entry;
+            entry.name = std::string(kShapeNames[s]) + "." + kSweepOpNames[op];
+            if (config.filter.empty() || entry.name.find(config.filter) != std::string::npos) {
+                series.push_back(entry);
+            }
+        }
+    }
+    if (config.list_only) {
+        for (std::size_t i = 0; i < series.size(); ++i) {
+            std::printf("sweep.%s\n", series[i].name.c_str());
+        }
+        series.clear();
+        return series;
+    }
+
+    for (std::size_t size = config.sweep_min; size <= config.sweep_max; size *= kSweepFactor) {
+        for (int s = 0; s < kShapes; ++s) {
+            const std::string prefix = std::string(kShapeNames[s]) + ".";
+            bool wanted = false;
+            for (std::size_t i = 0; i < series.size(); ++i) {
+                wanted |= HasPrefix(series[i].name, prefix);
+            }
+            if (!wanted) {
+                continue;
+            }
+            const Shape shape = static_cast<Shape>(s);
+            const std::string text = GenerateShape(shape, size, config.seed);
+            const jt::Json doc = jt::Json::parse(text).second;
+            for (std::size_t i = 0; i < series.size(); ++i) {
+                if (!HasPrefix(series[i].name, prefix)) {
+                    continue;
+                }
+                const std::string op_name = series[i].name.substr(prefix.size());
+                int op = 0;
+                while (op_name != kSweepOpNames[op]) {
+                    ++op;
+                }
+                // Repeat small operations so each sample spans at least 2 ms.
+                double once = TimeSweepOp(static_cast<SweepOp>(op), shape, text, doc, 1);
+                std::size_t reps = 1;
+                if (once < 2e6) {
+                    reps = static_cast<std::size_t>(std::min(10000.0, 2e6 / std::max(once, 1.0)));
+                }
+                std::vector<double> samples;
+                for (std::size_t run = 0; run < config.measure_runs; ++run) {
+                    samples.push_back(TimeSweepOp(static_cast<SweepOp>(op), shape, text, doc, reps));
+                }
+                SweepPoint point;
+                point.bytes = text.size();
+                point.median_ns = ComputeStats(samples).median_ns;
+                series[i].points.push_back(point);
+                if (!config.generate_report) {
+                    std::printf("sweep.%-24s %12zu bytes %16.0f ns %10.3f ns/byte\n",
+                                series[i].name.c_str(),
+                                point.bytes,
+                                point.median_ns,
+                                point.median_ns / point.bytes);
+                    std::fflush(stdout);
+                }
+            }
+        }
+    }
+
+    for (std::size_t i = 0; i < series.size(); ++i) {
+        series[i].exponent = FitExponent(series[i].points);
+        series[i].super_linear = series[i].exponent > kSuperLinearExponent;
+    }
+    return series;
+}
+
+inline void
+PrintSweepReport(const std::vector<SweepSeries>& series, const std::string& format)
+{
+    if (format == "csv") {
+        std::printf("case,bytes,median_ns,ns_per_byte,exponent,super_linear\n");
+        for (const auto& entry : series) {
+            for (const auto& point : entry.points) {
+                std::printf("%s,%zu,%.0f,%.4f,%.3f,%d\n",
+                            entry.name.c_str(),
+                            point.bytes,
+                            point.median_ns,
+                            point.median_ns / point.bytes,
+                            entry.exponent,
+                            entry.super_linear ? 1 : 0);
+            }
+        }
+    } else if (format == "json") {
+        std::printf("{\n  \"sweep\": [\n");
+        for (std::size_t i = 0; i < series.size(); ++i) {
+            const SweepSeries& entry = series[i];
+            std::printf("    {\"case\": \"%s\", \"exponent\": %.3f, \"super_linear\": %s, \"points\": [",
+                        entry.name.c_str(),
+                        entry.exponent,
+                        entry.super_linear ? "true" : "false");
+            for (std::size_t j = 0; j < entry.points.size(); ++j) {
+                std::printf("%s{\"bytes\": %zu, \"median_ns\": %.0f}",
+                            j ? ", " : "",
+                            entry.points[j].bytes,
+                            entry.points[j].median_ns);
+            }
+            std::printf("]}%s\n", i + 1 < series.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    } else {
+        std::printf("\n=== Scaling (exponent fitted over the %zu largest sizes) ===\n",
+                    kSweepFitPoints);
+        for (const auto& entry : series) {
+            std::printf("sweep.%-24s exponent=%.3f%s\n",
+                        entry.name.c_str(),
+                        entry.exponent,
+                        entry.super_linear ? "  SUPER-LINEAR" : "");
+        }
+    }
+}
+
+// Thread scaling. Every thread works on its own copy of a generated
+// document, except jsonpath_shared where all threads query one const
+// tree and parse_batch where Json::parseBatch() spreads threads x reps
+// copies over a pool of that size. Throughput is summed over threads,
+// and efficiency compares it against the single thread rate times the
+// thread count.
+enum ThreadOp
+{
+    kThreadParse,
+    kThreadStringify,
+    kThreadCopy,
+    kThreadQuery,
+    kThreadSharedQuery,
+    kThreadBatch,
+    kThreadOps
+};
+
+static const char* const kThreadOpNames[kThreadOps] = {
+    "parse", "stringify", "copy", "jsonpath", "jsonpath_shared", "parse_batch"
+};
+
+// Each thread repeats its operation until a single thread run spans
+// about this long, so thread start-up stays small against the work.
+static const double kThreadTargetNs = 20e6;
+
+struct ThreadPoint
+{
+    std::size_t threads;
+    double ops_per_sec;
+    double mb_per_sec;
+    double efficiency;
+};
+
+struct ThreadSeries
+{
+    std::string name;
+    std::vector<ThreadPoint> points;
+};
+
+inline std::uint64_t
+RunThreadOp(ThreadOp op,
+            const std::string& text,
+            const jt::Json& doc,
+            const char* query,
+            std::size_t reps)
+{
+    std::uint64_t sink = 0;
+    for (std::size_t i = 0; i < reps; ++i) {
+        switch (op) {
+            case kThreadParse:
+                sink += jt::Json::parse(text).first;
+                break;
+            case kThreadStringify:
+                sink += doc.toString().size();
+                break;
+            case kThreadCopy: {
+                jt::Json copy(doc);
+                sink += copy.getObject().size();
+                break;
+            }
+            default:
+                sink += doc.jsonpath(query).size();
+                break;
+        }
+    }
+    return sink;
+}
+
+// Wall time for `threads` threads to each finish `reps` operations.
+// Threads spin on a start flag so they all begin together, and each
+// parses its private document before the clock starts.
+inline double
+TimeThreadOp(ThreadOp op,
+             std::size_t threads,
+             const std::string& text,
+             const jt::Json& shared,
+             const char* query,
+             std::size_t reps)
+{
+    if (op == kThreadBatch) {
+        jt::WorkStealingExecutor pool(threads);
+        std::vector<jt::Json::Buffer> inputs(threads * reps, { text.data(), text.size() });
+        std::vector<std::pair<jt::Json::Status, jt::Json>> results(inputs.size());
+        jt::Json::BatchOptions options;
+        options.executor = &pool;
+        Clock::time_point start = Clock::now();
+        jt::Json::parseBatch(inputs.data(), inputs.size(), results.data(), options);
+        Clock::time_point end = Clock::now();
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            g_sink += results[i].first;
+        }
+        return static_cast<double>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+    std::atomic<std::size_t> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::uint64_t> sinks(threads, 0);
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; ++t) {
+        workers.push_back(std::thread([&, t]() {
+            std::string own_text;
+            jt::Json own_doc;
+            if (op != kThreadSharedQuery) {
+                own_text = text;
+                own_doc = jt::Json::parse(own_text).second;
+            }
+            const jt::Json& doc = op == kThreadSharedQuery ? shared : own_doc;
+            // Compile the query into this thread's cache before timing.
+            if (op == kThreadQuery || op == kThreadSharedQuery) {
+                sinks[t] += doc.jsonpath(query).size();
+            }
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            sinks[t] += RunThreadOp(op, own_text, doc, query, reps);
+        }));
+    }
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    Clock::time_point start = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (std::size_t t = 0; t < threads; ++t) {
+        workers[t].join();
+    }
+    Clock::time_point end = Clock::now();
+    for (std::size_t t = 0; t < threads; ++t) {
+        g_sink += sinks[t];
+    }
+    return static_cast<double>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+inline std::vector<ThreadSeries>
+RunThreadScaling(const BenchConfig& config)
+{
+    std::vector<ThreadSeries> series;
+    for (int op = 0; op < kThreadOps; ++op) {
+        ThreadSeries entry;
+        entry.name = kThreadOpNames[op];
+        if (config.filter.empty() || entry.name.find(config.filter) != std::string::npos) {
+            series.push_back(entry);
+        }
+    }
+    if (config.list_only) {
+        for (std::size_t i = 0; i < series.size(); ++i) {
+            std::printf("threads.%s\n", series[i].name.c_str());
+        }
+        series.clear();
+        return series;
+    }
+
+    std::vector<std::size_t> counts;
+    for (std::size_t n = 1; n < config.threads; n *= 2) {
+        counts.push_back(n);
+    }
+    counts.push_back(config.threads);
+
+    const std::string text = GenerateShape(kTwitter, config.gen_size, config.seed);
+    const jt::Json shared = jt::Json::parse(text).second;
+    const char* query = ShapeQuery(kTwitter);
+
+    for (std::size_t i = 0; i < series.size(); ++i) {
+        int op = 0;
+        while (series[i].name != kThreadOpNames[op]) {
+            ++op;
+        }
+        const ThreadOp thread_op = static_cast<ThreadOp>(op);
+        double once = TimeThreadOp(thread_op, 1, text, shared, query, 1);
+        std::size_t reps = 1;
+        if (once < kThreadTargetNs) {
+            reps = static_cast<std::size_t>(
+              std::min(100000.0, kThreadTargetNs / std::max(once, 1.0)));
+        }
+        double single_rate = 0;
+        for (std::size_t c = 0; c < counts.size(); ++c) {
+            std::vector<double> samples;
+            for (std::size_t run = 0; run < config.measure_runs; ++run) {
+                samples.push_back(TimeThreadOp(thread_op, counts[c], text, shared, query, reps));
+            }
+            const double median_ns = ComputeStats(samples).median_ns;
+            ThreadPoint point;
+            point.threads = counts[c];
+            point.ops_per_sec = counts[c] * reps * 1e9 / median_ns;
+            point.mb_per_sec = point.ops_per_sec * text.size() / (1024.0 * 1024.0);
+            if (c == 0) {
+                single_rate = point.ops_per_sec;
+            }
+            point.efficiency = point.ops_per_sec / (single_rate * counts[c]);
+            series[i].points.push_back(point);
+            if (!config.generate_report) {
+                std::printf("threads.%-18s %4zu threads %14.1f ops/s %10.2f MB/s %7.1f%%\n",
+                            series[i].name.c_str(),
+                            point.threads,
+                            point.ops_per_sec,
+                            point.mb_per_sec,
+                            point.efficiency * 100.0);
+                std::fflush(stdout);
+            }
+        }
+    }
+    return series;
+}
+
+inline void
+PrintThreadReport(const std::vector<ThreadSeries>& series,
+                  const std::string& format,
+                  std::size_t doc_bytes)
+{
+    if (format == "csv") {
+        std::printf("case,threads,ops_per_sec,mb_per_sec,efficiency\n");
+        for (const auto& entry : series) {
+            for (const auto& point : entry.points) {
+                std::printf("%s,%zu,%.1f,%.2f,%.3f\n",
+                            entry.name.c_str(),
+                            point.threads,
+                            point.ops_per_sec,
+                            point.mb_per_sec,
+                            point.efficiency);
+            }
+        }
+    } else if (format == "json") {
+        std::printf("{\n  \"document_bytes\": %zu,\n  \"hardware_threads\": %u,\n  \"threads\": [\n",
+                    doc_bytes,
+                    std::thread::hardware_concurrency());
+        for (std::size_t i = 0; i < series.size(); ++i) {
+            const ThreadSeries& entry = series[i];
+            std::printf("    {\"case\": \"%s\", \"points\": [", entry.name.c_str());
+            for (std::size_t j = 0; j < entry.points.size(); ++j) {
+                std::printf("%s{\"threads\": %zu, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f, "
+                            "\"efficiency\": %.3f}",
+                            j ? ", " : "",
+                            entry.points[j].threads,
+                            entry.points[j].ops_per_sec,
+                            entry.points[j].mb_per_sec,
+                            entry.points[j].efficiency);
+            }
+            std::printf("]}%s\n", i + 1 < series.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    } else {
+        const bool markdown = format == "markdown" || format == "md";
+        if (markdown) {
+            std::printf("## Thread Scaling\n\n");
+            std::printf("Document: %zu bytes per thread, %u hardware threads\n\n",
+                        doc_bytes,
+                        std::thread::hardware_concurrency());
+            std::printf("| Benchmark | Threads | Ops/s | MB/s | Efficiency |\n");
+            std::printf("|-----------|---------|-------|------|------------|\n");
+        } else {
+            std::printf("\n=== Thread scaling (%zu byte document per thread, %u hardware threads) ===\n",
+                        doc_bytes,
+                        std::thread::hardware_concurrency());
+        }
+        for (const auto& entry : series) {
+            for (const auto& point : entry.points) {
+                std::printf(markdown ? "| %s | %zu | %.1f | %.2f | %.1f%% |\n"
+                                     : "threads.%-18s %4zu threads %14.1f ops/s %10.2f MB/s %7.1f%%\n",
+                            entry.name.c_str(),
+                            point.threads,
+                            point.ops_per_sec,
+                            point.mb_per_sec,
+                            point.efficiency * 100.0);
+            }
+        }
+    }
+}
+
+// Memory footprint. Each input is parsed with allocation tracking on and
+// the trees kept alive, so the net live heap is what the DOM costs. The
+// resident set is read around the same parse, and the trees are then
+// destroyed under the clock.
+struct MemoryInput
+{
+    std::string name;
+    std::vector<std::string> texts;
+    std::size_t bytes;
+};
+
+struct MemoryResult
+{
+    std::string name;
+    std::size_t input_bytes;
+    std::size_t documents;
+    double dom_bytes;
+    double allocs;
+    double peak_heap_bytes;
+    double rss_delta_bytes;
+    double destroy_ns;
+};
+
+// Resident set size in bytes, or its high water mark when peak is set.
+inline double
+ResidentBytes(bool peak)
+{
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    const std::string key = peak ? "VmHWM:" : "VmRSS:";
+    std::string line;
+    while (std::getline(status, line)) {
+        if (HasPrefix(line, key)) {
+            return std::atof(line.c_str() + key.size()) * 1024.0;
+        }
+    }
+    return 0;
+#else
+    // getrusage only has the peak; ru_maxrss is bytes on macOS, KiB elsewhere.
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<double>(usage.ru_maxrss);
+#else
+    return static_cast<double>(usage.ru_maxrss) * 1024.0;
+#endif
+#endif
+}
+
+// Drops the high water mark to the current resident set so the next
+// VmHWM read covers only what follows. Returns false where unsupported.
+inline bool
+ResetPeakResident()
+{
+#ifdef __linux__
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.flush();
+    return clear_refs.good();
+#else
+    return false;
+#endif
+}
+
+inline MemoryResult
+MeasureMemory(const MemoryInput& input, std::size_t runs)
+{
+    std::vector<double> dom_bytes, allocs, peaks, rss, destroy;
+    for (std::size_t run = 0; run < runs; ++run) {
+        std::vector<jt::Json> docs;
+        docs.reserve(input.texts.size());
+#ifdef __GLIBC__
+        // Hand freed pages back so earlier runs do not absorb this one.
+        malloc_trim(0);
+#endif
+        const bool peak_reset = ResetPeakResident();
+        const double rss_before = ResidentBytes(peak_reset);
+        g_alloc_count.store(0, std::memory_order_relaxed);
+        g_alloc_live.store(0, std::memory_order_relaxed);
+        g_alloc_peak.store(0, std::memory_order_relaxed);
+        g_alloc_tracking.store(true, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < input.texts.size(); ++i) {
+            docs.push_back(jt::Json::parse(input.texts[i]).second);
+        }
+        g_alloc_tracking.store(false, std::memory_order_relaxed);
+        const double rss_after = ResidentBytes(peak_reset);
+        dom_bytes.push_back(static_cast<double>(g_alloc_live.load(std::memory_order_relaxed)));
+        allocs.push_back(static_cast<double>(g_alloc_count.load(std::memory_order_relaxed)));
+        peaks.push_back(static_cast<double>(g_alloc_peak.load(std::memory_order_relaxed)));
+        rss.push_back(std::max(0.0, rss_after - rss_before));
+
+        Clock::time_point start = Clock::now();
+        docs.clear();
+        Clock::time_point end = Clock::now();
+        destroy.push_back(static_cast<double>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+    }
+    MemoryResult result;
+    result.name = input.name;
+    result.input_bytes = input.bytes;
+    result.documents = input.texts.size();
+    result.dom_bytes = ComputeStats(dom_bytes).median_ns;
+    result.allocs = ComputeStats(allocs).median_ns;
+    result.peak_heap_bytes = ComputeStats(peaks).median_ns;
+    result.rss_delta_bytes = ComputeStats(rss).median_ns;
+    result.destroy_ns = ComputeStats(destroy).median_ns;
+    return result;
+}
+
+inline void
+PrintMemoryReport(const std::vector<MemoryResult>& results, const std::string& format)
+{
+    if (format == "csv") {
+        std::printf("benchmark,input_bytes,documents,dom_bytes,dom_per_input_byte,allocs,"
+                    "peak_heap_bytes,rss_delta_bytes,destroy_ns\n");
+        for (const auto& r : results) {
+            std::printf("%s,%zu,%zu,%.0f,%.3f,%.0f,%.0f,%.0f,%.0f\n",
+                        r.name.c_str(),
+                        r.input_bytes,
+                        r.documents,
+                        r.dom_bytes,
+                        r.dom_bytes / r.input_bytes,
+                        r.allocs,
+                        r.peak_heap_bytes,
+                        r.rss_delta_bytes,
+                        r.destroy_ns);
+        }
+    } else if (format == "json") {
+        std::printf("{\n  \"memory\": [\n");
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            const MemoryResult& r = results[i];
+            std::printf("    {\"name\": \"%s\", \"input_bytes\": %zu, \"documents\": %zu, "
+                        "\"dom_bytes\": %.0f, \"dom_per_input_byte\": %.3f, \"allocs\": %.0f, "
+                        "\"peak_heap_bytes\": %.0f, \"rss_delta_bytes\": %.0f, \"destroy_ns\": %.0f}%s\n",
+                        r.name.c_str(),
+                        r.input_bytes,
+                        r.documents,
+                        r.dom_bytes,
+                        r.dom_bytes / r.input_bytes,
+                        r.allocs,
+                        r.peak_heap_bytes,
+                        r.rss_delta_bytes,
+                        r.destroy_ns,
+                        i + 1 < results.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    } else {
+        const bool markdown = format == "markdown" || format == "md";
+        if (markdown) {
+            std::printf("## Memory Footprint\n\n");
+            std::printf("| Benchmark | Input Bytes | DOM Bytes | DOM/Input | Allocs | Peak Heap | RSS Delta | Destroy (ns) |\n");
+            std::printf("|-----------|-------------|-----------|-----------|--------|-----------|-----------|--------------|\n");
+        } else {
+            std::printf("\n=== Memory footprint ===\n");
+        }
+        for (const auto& r : results) {
+            std::printf(markdown ? "| %s | %zu | %.0f | %.2f | %.0f | %.0f | %.0f | %.0f |\n"
+                                 : "%-28s input=%-10zu dom=%-12.0f ratio=%-7.2f allocs=%-9.0f "
+                                   "peak=%-12.0f rss=%-12.0f destroy=%.0f ns\n",
+                        r.name.c_str(),
+                        r.input_bytes,
+                        r.dom_bytes,
+                        r.dom_bytes / r.input_bytes,
+                        r.allocs,
+                        r.peak_heap_bytes,
+                        r.rss_delta_bytes,
+                        r.destroy_ns);
+        }
+    }
+}
+
+// Cold cache and file cases. The hot numbers elsewhere parse one small
+// buffer that stays in cache. Here parse rotates through a pool of
+// distinct documents at least twice the size of the last level cache,
+// so every message arrives cold, and the file cases map the document
+// fresh each time so page faults are part of the cost.
+static const std::size_t kDefaultLLCBytes = 32 << 20;
+static const std::size_t kColdPoolFactor = 2;
+static const std::size_t kColdDistinctDocs = 8;
+static const double kColdTargetNs = 50e6;
+
+struct ColdResult
+{
+    std::string name;
+    std::size_t bytes;
+    std::size_t pool_docs;
+    double hot_ns;
+    double cold_ns;
+};
+
+inline std::size_t
+LastLevelCacheBytes()
+{
+#if defined(__linux__) && defined(_SC_LEVEL3_CACHE_SIZE)
+    long bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (bytes > 0) {
+        return static_cast<std::size_t>(bytes);
+    }
+    bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (bytes > 0) {
+        return static_cast<std::size_t>(bytes);
+    }
+#endif
+    return kDefaultLLCBytes;
+}
+
+// Median time per parse over `reps` parses that walk the pool in order.
+inline double
+TimeRotatingParse(const std::vector<std::string>& pool, std::size_t reps, std::size_t runs)
+{
+    std::vector<double> samples;
+    for (std::size_t run = 0; run < runs; ++run) {
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < reps; ++i) {
+            g_sink += jt::Json::parse(pool[i % pool.size()]).first;
+        }
+        Clock::time_point end = Clock::now();
+        samples.push_back(static_cast<double>(
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) /
+                          reps);
+    }
+    return ComputeStats(samples).median_ns;
+}
+
+// Median time to open, map, parse and unmap `path`. With drop_cache the
+// file's pages are evicted from the page cache first, so the parse also
+// pays for reading them back in.
+inline double
+TimeMappedParse(const std::string& path, bool drop_cache, std::size_t reps, std::size_t runs)
+{
+    std::vector<double> samples;
+    for (std::size_t run = 0; run < runs; ++run) {
+        double total = 0;
+        for (std::size_t i = 0; i < reps; ++i) {
+            int fd = open(path.c_str(), O_RDONLY);
+            Ensure(fd >= 0, "unable to open " + path);
+            if (drop_cache) {
+                fdatasync(fd);
+#ifdef POSIX_FADV_DONTNEED
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+            }
+            Clock::time_point start = Clock::now();
+            struct stat st;
+            Ensure(fstat(fd, &st) == 0, "unable to stat " + path);
+            const std::size_t size = static_cast<std::size_t>(st.st_size);
+            void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            Ensure(map != MAP_FAILED, "unable to map " + path);
+            g_sink += jt::Json::parse(static_cast<const char*>(map), size).first;
+            munmap(map, size);
+            Clock::time_point end = Clock::now();
+            close(fd);
+            total += static_cast<double>(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+        samples.push_back(total / reps);
+    }
+    return ComputeStats(samples).median_ns;
+}
+
+inline std::vector<ColdResult>
+RunCold(const BenchConfig& config)
+{
+    std::vector<std::string> names;
+    for (int s = 0; s < kShapes; ++s) {
+        names.push_back(std::string("cold.") + kShapeNames[s]);
+        names.push_back(std::string("file.mmap_") + kShapeNames[s]);
+        names.push_back(std::string("file.mmap_uncached_") + kShapeNames[s]);
+    }
+    std::vector<ColdResult> results;
+    const std::size_t pool_bytes =
+      config.cold_pool ? config.cold_pool : kColdPoolFactor * LastLevelCacheBytes();
+    const char* tmpdir = std::getenv("TMPDIR");
+    for (std::size_t n = 0; n < names.size(); ++n) {
+        if (!config.filter.empty() && names[n].find(config.filter) == std::string::npos) {
+            continue;
+        }
+        if (config.list_only) {
+            std::printf("%s\n", names[n].c_str());
+            continue;
+        }
+        const Shape shape = static_cast<Shape>(n / 3);
+        std::vector<std::string> pool(1, GenerateShape(shape, config.gen_size, config.seed));
+        ColdResult result;
+        result.name = names[n];
+        result.bytes = pool[0].size();
+        const double once = TimeRotatingParse(pool, 1, 1);
+        const std::size_t reps = std::max<std::size_t>(
+          1, static_cast<std::size_t>(config.scale * kColdTargetNs / std::max(once, 1.0)));
+        result.hot_ns = TimeRotatingParse(pool, reps, config.measure_runs);
+
+        if (n % 3 == 0) {
+            // Caches work on addresses, so the pool repeats a few distinct
+            // documents in separate buffers instead of generating each one.
+            const std::size_t pool_docs =
+              std::max<std::size_t>(2, (pool_bytes + result.bytes - 1) / result.bytes);
+            for (std::size_t i = 1; i < kColdDistinctDocs && i < pool_docs; ++i) {
+                pool.push_back(GenerateShape(shape, config.gen_size, config.seed + i));
             }
-            std::printf("\n");
+            for (std::size_t i = pool.size(); i < pool_docs; ++i) {
+                pool.push_back(std::string(pool[i % kColdDistinctDocs]));
+            }
+            // One untimed pass so the pool is resident and only cache
+            // misses, not first-touch faults, separate it from hot.
+            TimeRotatingParse(pool, pool.size(), 1);
+            result.pool_docs = pool.size();
+            result.cold_ns = TimeRotatingParse(pool, pool.size(), config.measure_runs);
+        } else {
+            std::string path = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") +
+                               "/json_perf_" + kShapeNames[shape] + ".json";
+            {
+                std::ofstream out(path.c_str(), std::ios::out | std::ios::binary);
+                out.write(pool[0].data(), static_cast<std::streamsize>(pool[0].size()));
+                Ensure(out.good(), "unable to write " + path);
+            }
+            const bool drop_cache = n % 3 == 2;
+            result.pool_docs = 1;
+            result.cold_ns = TimeMappedParse(path,
+                                             drop_cache,
+                                             std::min<std::size_t>(reps, 64),
+                                             config.measure_runs);
+            std::remove(path.c_str());
+        }
+        results.push_back(result);
+        if (!config.generate_report) {
+            std::printf("%-32s hot=%.2f MB/s  cold=%.2f MB/s  slowdown=%.2fx\n",
+                        result.name.c_str(),
+                        result.bytes * 1e3 / result.hot_ns,
+                        result.bytes * 1e3 / result.cold_ns,
+                        result.cold_ns / result.hot_ns);
+            std::fflush(stdout);
         }
     }
+    return results;
+}
 
-    const std::vector<BenchResult>& getResults() const
-    {
-        return results_;
+inline void
+PrintColdReport(const std::vector<ColdResult>& results, const std::string& format)
+{
+    if (format == "csv") {
+        std::printf("benchmark,bytes,pool_docs,hot_ns,cold_ns,hot_mb_s,cold_mb_s,slowdown\n");
+        for (const auto& r : results) {
+            std::printf("%s,%zu,%zu,%.0f,%.0f,%.2f,%.2f,%.3f\n",
+                        r.name.c_str(),
+                        r.bytes,
+                        r.pool_docs,
+                        r.hot_ns,
+                        r.cold_ns,
+                        r.bytes * 1e3 / r.hot_ns,
+                        r.bytes * 1e3 / r.cold_ns,
+                        r.cold_ns / r.hot_ns);
+        }
+    } else if (format == "json") {
+        std::printf("{\n  \"llc_bytes\": %zu,\n  \"cold\": [\n", LastLevelCacheBytes());
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            const ColdResult& r = results[i];
+            std::printf("    {\"name\": \"%s\", \"bytes\": %zu, \"pool_docs\": %zu, \"hot_ns\": %.0f, "
+                        "\"cold_ns\": %.0f, \"hot_mb_s\": %.2f, \"cold_mb_s\": %.2f, \"slowdown\": %.3f}%s\n",
+                        r.name.c_str(),
+                        r.bytes,
+                        r.pool_docs,
+                        r.hot_ns,
+                        r.cold_ns,
+                        r.bytes * 1e3 / r.hot_ns,
+                        r.bytes * 1e3 / r.cold_ns,
+                        r.cold_ns / r.hot_ns,
+                        i + 1 < results.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    } else {
+        const bool markdown = format == "markdown" || format == "md";
+        if (markdown) {
+            std::printf("## Cold Cache and File Parsing\n\n");
+            std::printf("Last level cache: %zu bytes\n\n", LastLevelCacheBytes());
+            std::printf("| Benchmark | Bytes | Pool | Hot (MB/s) | Cold (MB/s) | Slowdown |\n");
+            std::printf("|-----------|-------|------|------------|-------------|----------|\n");
+        } else {
+            std::printf("\n=== Cold cache and file parsing (LLC %zu bytes) ===\n", LastLevelCacheBytes());
+        }
+        for (const auto& r : results) {
+            std::printf(markdown ? "| %s | %zu | %zu | %.2f | %.2f | %.2fx |\n"
+                                 : "%-32s bytes=%-10zu pool=%-6zu hot=%-10.2f cold=%-10.2f slowdown=%.2fx\n",
+                        r.name.c_str(),
+                        r.bytes,
+                        r.pool_docs,
+                        r.bytes * 1e3 / r.hot_ns,
+                        r.bytes * 1e3 / r.cold_ns,
+                        r.cold_ns / r.hot_ns);
+        }
     }
+}
 
-  private:
-    BenchConfig config_;
-    std::vector<BenchResult> results_;
+// Trace replay. A trace is a JSON Lines file with one operation per line:
+//
+//   {"op": "parse", "input": "orders.json", "repeat": 6}
+//   {"op": "jsonpath", "generate": "twitter", "size": "64K", "path": "$..id"}
+//   {"op": "update", "input": "orders.json", "path": "$..price", "value": 0}
+//
+// Inputs are files relative to the trace or generated shapes. Each is
+// parsed once up front. Operations other than parse run on a working
+// copy that is reset before every pass, so updates and deletes see the
+// effects of earlier lines the way a long-lived document would. Lines
+// run in trace order, so the recorded interleaving is kept.
+enum ReplayOp
+{
+    kReplayParse,
+    kReplayRead,
+    kReplayBuild,
+    kReplayStringify,
+    kReplayQuery,
+    kReplayUpdate,
+    kReplayDelete,
+    kReplayAggregate,
+    kReplayOps
 };
 
-inline std::string
-ReadTextFile(const std::string& path)
+static const char* const kReplayOpNames[kReplayOps] = {
+    "parse", "read", "build", "stringify", "jsonpath", "update", "delete", "aggregate"
+};
+
+struct ReplayInput
 {
-    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
-    Ensure(file.good(), std::string("unable to open file: ") + path);
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
-}
+    std::string text;
+    jt::Json doc;
+    jt::Json working;
+};
 
-struct Corpus
+struct ReplayStep
+{
+    ReplayOp op;
+    std::size_t input;
+    std::string path;
+    jt::Json value;
+    std::size_t repeat;
+};
+
+struct ReplayTrace
+{
+    std::vector<ReplayInput> inputs;
+    std::vector<ReplayStep> steps;
+};
+
+struct ReplayOpResult
 {
     std::string name;
-    std::vector<std::string> files;
-    std::size_t total_bytes;
+    std::uint64_t bytes;
+    double total_ns;
+    LatencyResult latency;
 };
 
-inline bool
-HasPrefix(const std::string& s, const std::string& prefix)
+struct ReplayReport
 {
-    return s.compare(0, prefix.size(), prefix) == 0;
+    std::vector<ReplayOpResult> ops;
+    std::uint64_t total_ops;
+    std::uint64_t total_bytes;
+    double wall_ns;
+};
+
+// Touches every value, the way a handler reads a request.
+inline std::uint64_t
+ReadTree(const jt::Json& json)
+{
+    std::uint64_t sum = 1;
+    switch (json.getType()) {
+        case jt::Json::Bool:
+            return json.getBool();
+        case jt::Json::Long:
+            return static_cast<std::uint64_t>(json.getLong());
+        case jt::Json::Float:
+        case jt::Json::Double:
+            return json.getNumber() > 0;
+        case jt::Json::String:
+            return json.getString().size();
+        case jt::Json::Array:
+            for (const jt::Json& element : json.getArray()) {
+                sum += ReadTree(element);
+            }
+            return sum;
+        case jt::Json::Object:
+            for (const auto& member : json.getObject()) {
+                sum += member.first.size() + ReadTree(member.second);
+            }
+            return sum;
+        default:
+            return 0;
+    }
 }
 
-inline Corpus
-LoadCorpus(const std::string& dir, const std::string& prefix, std::size_t limit)
+// Rebuilds a document value by value through the mutating API, the way
+// a handler assembles a response.
+inline jt::Json
+BuildTree(const jt::Json& json)
 {
-    Corpus corpus;
-    corpus.total_bytes = 0;
-    DIR* handle = opendir(dir.c_str());
-    Ensure(handle != NULL, std::string("unable to open directory: ") + dir);
-    std::vector<std::string> paths;
-    struct dirent* entry;
-    while ((entry = readdir(handle)) != NULL) {
-        const char* name = entry->d_name;
-        if (name[0] == '.') {
+    jt::Json out;
+    if (json.isArray()) {
+        out.setArray();
+        for (const jt::Json& element : json.getArray()) {
+            out.getArray().push_back(BuildTree(element));
+        }
+    } else if (json.isObject()) {
+        out.setObject();
+        for (const auto& member : json.getObject()) {
+            out[member.first] = BuildTree(member.second);
+        }
+    } else {
+        out = json;
+    }
+    return out;
+}
+
+inline ReplayTrace
+LoadTrace(const std::string& path, std::uint64_t default_seed)
+{
+    std::string dir = ".";
+    std::size_t slash = path.rfind('/');
+    if (slash != std::string::npos) {
+        dir = path.substr(0, slash);
+    }
+    std::ifstream file(path.c_str());
+    Ensure(file.good(), "unable to open trace: " + path);
+
+    ReplayTrace trace;
+    std::vector<std::string> keys;
+    std::string line;
+    for (std::size_t number = 1; std::getline(file, line); ++number) {
+        const std::string where = path + ":" + std::to_string(number) + ": ";
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
             continue;
         }
-        std::string filename(name);
-        if (!prefix.empty() && !HasPrefix(filename, prefix)) {
+        std::pair<jt::Json::Status, jt::Json> parsed = jt::Json::parse(line);
+        Ensure(parsed.first == jt::Json::success,
+               where + jt::Json::StatusToString(parsed.first));
+        jt::Json& entry = parsed.second;
+        Ensure(entry.isObject() && entry.contains("op") && entry["op"].isString(),
+               where + "missing \"op\"");
+
+        ReplayStep step;
+        int op = 0;
+        while (op < kReplayOps && entry["op"].getString() != kReplayOpNames[op]) {
+            ++op;
+        }
+        Ensure(op < kReplayOps, where + "unknown op: " + entry["op"].getString());
+        step.op = static_cast<ReplayOp>(op);
+        step.repeat = 1;
+        if (entry.contains("repeat")) {
+            Ensure(entry["repeat"].isLong() && entry["repeat"].getLong() > 0,
+                   where + "\"repeat\" must be a positive integer");
+            step.repeat = static_cast<std::size_t>(entry["repeat"].getLong());
+        }
+        if (entry.contains("path")) {
+            Ensure(entry["path"].isString(), where + "\"path\" must be a string");
+            step.path = entry["path"].getString();
+        }
+        Ensure(!step.path.empty() || op < kReplayQuery, where + "\"path\" is required");
+        if (entry.contains("value")) {
+            step.value = entry["value"];
+        }
+
+        std::string key;
+        std::string text;
+        if (entry.contains("input")) {
+            Ensure(entry["input"].isString(), where + "\"input\" must be a string");
+            std::string input = entry["input"].getString();
+            key = "file:" + (input[0] == '/' ? input : dir + "/" + input);
+        } else {
+            Ensure(entry.contains("generate") && entry["generate"].isString(),
+                   where + "needs \"input\" or \"generate\"");
+            const int shape = ShapeByName(entry["generate"].getString());
+            Ensure(shape >= 0, where + "unknown shape: " + entry["generate"].getString());
+            std::size_t size = 64 << 10;
+            if (entry.contains("size")) {
+                size = entry["size"].isString()
+                         ? ParseSize(entry["size"].getString())
+                         : static_cast<std::size_t>(entry["size"].getNumber());
+            }
+            std::uint64_t seed = default_seed;
+            if (entry.contains("seed")) {
+                seed = static_cast<std::uint64_t>(entry["seed"].getLong());
+            }
+            key = "gen:" + std::to_string(shape) + ":" + std::to_string(size) + ":" +
+                  std::to_string(seed);
+        }
+        std::size_t index = std::find(keys.begin(), keys.end(), key) - keys.begin();
+        if (index == keys.size()) {
+            ReplayInput input;
+            if (HasPrefix(key, "file:")) {
+                input.text = ReadTextFile(key.substr(5));
+            } else {
+                std::size_t shape = 0, size = 0;
+                unsigned long long seed = 0;
+                std::sscanf(key.c_str(), "gen:%zu:%zu:%llu", &shape, &size, &seed);
+                input.text = GenerateShape(static_cast<Shape>(shape), size, seed);
+            }
+            parsed = jt::Json::parse(input.text);
+            Ensure(parsed.first == jt::Json::success,
+                   where + "input does not parse: " + jt::Json::StatusToString(parsed.first));
+            input.doc = parsed.second;
+            trace.inputs.push_back(input);
+            keys.push_back(key);
+        }
+        step.input = index;
+        trace.steps.push_back(step);
+    }
+    Ensure(!trace.steps.empty(), "trace has no operations: " + path);
+    return trace;
+}
+
+inline std::uint64_t
+RunReplayStep(ReplayTrace& trace, const ReplayStep& step)
+{
+    ReplayInput& input = trace.inputs[step.input];
+    switch (step.op) {
+        case kReplayParse:
+            return jt::Json::parse(input.text).first;
+        case kReplayRead:
+            return ReadTree(input.working);
+        case kReplayBuild:
+            return BuildTree(input.working).isNull();
+        case kReplayStringify:
+            return input.working.toString().size();
+        case kReplayQuery:
+            return input.working.jsonpath(step.path).size();
+        case kReplayUpdate:
+            return input.working.updateJsonpath(step.path, step.value);
+        case kReplayDelete:
+            return input.working.deleteJsonpath(step.path);
+        default:
+            return input.working.aggregateJsonpath(step.path).isNull();
+    }
+}
+
+inline ReplayReport
+RunReplay(const BenchConfig& config)
+{
+    ReplayTrace trace = LoadTrace(config.replay, config.seed);
+    const std::uint64_t overhead = TimerOverheadNanos();
+    std::vector<LatencyHistogram> histograms(kReplayOps);
+    std::vector<double> totals(kReplayOps, 0.0);
+    std::vector<std::uint64_t> bytes(kReplayOps, 0);
+    ReplayReport report;
+    report.total_ops = 0;
+    report.total_bytes = 0;
+    report.wall_ns = 0;
+
+    for (std::size_t pass = 0; pass < config.warmup_runs + config.measure_runs; ++pass) {
+        const bool measured = pass >= config.warmup_runs;
+        for (std::size_t i = 0; i < trace.inputs.size(); ++i) {
+            trace.inputs[i].working = trace.inputs[i].doc;
+        }
+        std::uint64_t pass_start = MonotonicNanos();
+        for (const ReplayStep& step : trace.steps) {
+            for (std::size_t r = 0; r < step.repeat; ++r) {
+                std::uint64_t start = MonotonicNanos();
+                g_sink += RunReplayStep(trace, step);
+                std::uint64_t elapsed = MonotonicNanos() - start;
+                if (!measured) {
+                    continue;
+                }
+                elapsed = elapsed > overhead ? elapsed - overhead : 0;
+                histograms[step.op].record(elapsed);
+                totals[step.op] += static_cast<double>(elapsed);
+                if (step.op == kReplayParse) {
+                    bytes[step.op] += trace.inputs[step.input].text.size();
+                }
+                ++report.total_ops;
+            }
+        }
+        if (measured) {
+            report.wall_ns += static_cast<double>(MonotonicNanos() - pass_start);
+        }
+    }
+
+    for (int op = 0; op < kReplayOps; ++op) {
+        if (!histograms[op].total()) {
             continue;
         }
-        std::string path = dir + "/" + filename;
-        paths.push_back(path);
+        ReplayOpResult result;
+        result.name = kReplayOpNames[op];
+        result.bytes = bytes[op];
+        result.total_ns = totals[op];
+        result.latency = SummarizeLatency(result.name, histograms[op]);
+        report.total_bytes += bytes[op];
+        report.ops.push_back(result);
     }
-    closedir(handle);
+    return report;
+}
 
-    std::sort(paths.begin(), paths.end());
-    for (std::size_t i = 0; i < paths.size(); ++i) {
-        if (limit > 0 && corpus.files.size() >= limit) {
-            break;
+inline void
+PrintReplayReport(const ReplayReport& report, const std::string& format)
+{
+    double busy_ns = 0;
+    for (const auto& r : report.ops) {
+        busy_ns += r.total_ns;
+    }
+    const double ops_per_sec = report.wall_ns > 0 ? report.total_ops * 1e9 / report.wall_ns : 0;
+    const double parse_mb_s = report.wall_ns > 0 ? report.total_bytes * 1e3 / report.wall_ns : 0;
+    if (format == "csv") {
+        std::printf("op,count,share,mean_ns,p50_ns,p99_ns,p999_ns,max_ns\n");
+        for (const auto& r : report.ops) {
+            std::printf("%s,%llu,%.4f,%.1f,%llu,%llu,%llu,%llu\n",
+                        r.name.c_str(),
+                        static_cast<unsigned long long>(r.latency.count),
+                        busy_ns > 0 ? r.total_ns / busy_ns : 0.0,
+                        r.latency.mean_ns,
+                        static_cast<unsigned long long>(r.latency.p50_ns),
+                        static_cast<unsigned long long>(r.latency.p99_ns),
+                        static_cast<unsigned long long>(r.latency.p999_ns),
+                        static_cast<unsigned long long>(r.latency.max_ns));
+        }
+    } else if (format == "json") {
+        std::printf("{\n  \"total_ops\": %llu,\n  \"wall_ns\": %.0f,\n  \"ops_per_sec\": %.1f,\n"
+                    "  \"parse_mb_s\": %.2f,\n  \"ops\": [\n",
+                    static_cast<unsigned long long>(report.total_ops),
+                    report.wall_ns,
+                    ops_per_sec,
+                    parse_mb_s);
+        for (std::size_t i = 0; i < report.ops.size(); ++i) {
+            const ReplayOpResult& r = report.ops[i];
+            std::printf("    {\"op\": \"%s\", \"count\": %llu, \"share\": %.4f, \"mean_ns\": %.1f, "
+                        "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}%s\n",
+                        r.name.c_str(),
+                        static_cast<unsigned long long>(r.latency.count),
+                        busy_ns > 0 ? r.total_ns / busy_ns : 0.0,
+                        r.latency.mean_ns,
+                        static_cast<unsigned long long>(r.latency.p50_ns),
+                        static_cast<unsigned long long>(r.latency.p99_ns),
+                        static_cast<unsigned long long>(r.latency.p999_ns),
+                        static_cast<unsigned long long>(r.latency.max_ns),
+                        i + 1 < report.ops.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    } else {
+        const bool markdown = format == "markdown" || format == "md";
+        if (markdown) {
+            std::printf("## Trace Replay\n\n");
+            std::printf("%llu operations, %.1f ops/s, parse input %.2f MB/s\n\n",
+                        static_cast<unsigned long long>(report.total_ops),
+                        ops_per_sec,
+                        parse_mb_s);
+            std::printf("| Op | Count | Time Share | Mean (ns) | p50 (ns) | p99 (ns) | p99.9 (ns) | Max (ns) |\n");
+            std::printf("|----|-------|------------|-----------|----------|----------|------------|----------|\n");
+        } else {
+            std::printf("\n=== Trace replay: %llu ops in %.2f ms, %.1f ops/s, parse input %.2f MB/s ===\n",
+                        static_cast<unsigned long long>(report.total_ops),
+                        report.wall_ns / 1e6,
+                        ops_per_sec,
+                        parse_mb_s);
+        }
+        for (const auto& r : report.ops) {
+            std::printf(markdown ? "| %s | %llu | %.1f%% | %.1f | %llu | %llu | %llu | %llu |\n"
+                                 : "replay.%-12s n=%-9llu time=%5.1f%%  mean=%-10.1f p50=%-10llu "
+                                   "p99=%-10llu p99.9=%-10llu max=%llu\n",
+                        r.name.c_str(),
+                        static_cast<unsigned long long>(r.latency.count),
+                        busy_ns > 0 ? r.total_ns * 100.0 / busy_ns : 0.0,
+                        r.latency.mean_ns,
+                        static_cast<unsigned long long>(r.latency.p50_ns),
+                        static_cast<unsigned long long>(r.latency.p99_ns),
+                        static_cast<unsigned long long>(r.latency.p999_ns),
+                        static_cast<unsigned long long>(r.latency.max_ns));
         }
-        const std::string& path = paths[i];
-        std::string contents = ReadTextFile(path);
-        corpus.total_bytes += contents.size();
-        corpus.files.push_back(contents);
     }
-    corpus.name = dir;
-    return corpus;
 }
 
 inline BenchConfig
@@ -426,6 +2888,21 @@ ParseArgs(int argc, char** argv)
             std::printf("  --filter STR     Only run benchmarks containing STR\n");
             std::printf("  --list           List benchmark names\n");
             std::printf("  --report FORMAT  Generate report (text, csv, json, markdown)\n");
+            std::printf("  --counters       Record hardware counters (Linux perf_event_open)\n");
+            std::printf("  --compare LIB    Run equivalent cases against LIB (nlohmann)\n");
+            std::printf("  --gen-size SIZE  Size of generated documents, e.g. 64K or 4M (default 1M)\n");
+            std::printf("  --seed N         Seed for generated documents (default 1)\n");
+            std::printf("  --generate SHAPE Print a generated document and exit\n");
+            std::printf("                   (canada, twitter, wide, deep, escapes)\n");
+            std::printf("  --sweep          Time operations over growing sizes and fit exponents\n");
+            std::printf("  --latency        Time each operation alone and report p50/p99/p99.9/max\n");
+            std::printf("  --sweep-min SIZE Smallest sweep size (default 1K)\n");
+            std::printf("  --sweep-max SIZE Largest sweep size (default 16M, up to 1G)\n");
+            std::printf("  --threads N      Measure concurrent scaling from 1 to N threads\n");
+            std::printf("  --memory         Report DOM bytes, RSS growth and destruction time\n");
+            std::printf("  --cold           Parse a pool larger than the LLC and mmap'd files\n");
+            std::printf("  --cold-pool SIZE Bytes in the --cold pool (default twice the LLC)\n");
+            std::printf("  --replay TRACE   Replay a JSON Lines operation trace\n");
             std::exit(0);
         } else if (HasPrefix(arg, "--warmup=")) {
             config.warmup_runs = static_cast<std::size_t>(std::strtoul(arg.c_str() + 9, NULL, 10));
@@ -452,6 +2929,61 @@ ParseArgs(int argc, char** argv)
             config.filter = argv[++i];
         } else if (arg == "--list") {
             config.list_only = true;
+        } else if (arg == "--counters") {
+            config.counters = true;
+        } else if (HasPrefix(arg, "--compare=")) {
+            config.compare = arg.substr(10);
+        } else if (arg == "--compare") {
+            Ensure(i + 1 < argc, "--compare requires an argument");
+            config.compare = argv[++i];
+        } else if (HasPrefix(arg, "--gen-size=")) {
+            config.gen_size = ParseSize(arg.substr(11));
+        } else if (arg == "--gen-size") {
+            Ensure(i + 1 < argc, "--gen-size requires an argument");
+            config.gen_size = ParseSize(argv[++i]);
+        } else if (HasPrefix(arg, "--seed=")) {
+            config.seed = std::strtoull(arg.c_str() + 7, NULL, 10);
+        } else if (arg == "--seed") {
+            Ensure(i + 1 < argc, "--seed requires an argument");
+            config.seed = std::strtoull(argv[++i], NULL, 10);
+        } else if (HasPrefix(arg, "--generate=")) {
+            config.generate = arg.substr(11);
+        } else if (arg == "--generate") {
+            Ensure(i + 1 < argc, "--generate requires an argument");
+            config.generate = argv[++i];
+        } else if (arg == "--sweep") {
+            config.sweep = true;
+        } else if (arg == "--latency") {
+            config.latency = true;
+        } else if (arg == "--memory") {
+            config.memory = true;
+        } else if (arg == "--cold") {
+            config.cold = true;
+        } else if (HasPrefix(arg, "--replay=")) {
+            config.replay = arg.substr(9);
+        } else if (arg == "--replay") {
+            Ensure(i + 1 < argc, "--replay requires an argument");
+            config.replay = argv[++i];
+        } else if (HasPrefix(arg, "--cold-pool=")) {
+            config.cold_pool = ParseSize(arg.substr(12));
+        } else if (arg == "--cold-pool") {
+            Ensure(i + 1 < argc, "--cold-pool requires an argument");
+            config.cold_pool = ParseSize(argv[++i]);
+        } else if (HasPrefix(arg, "--sweep-min=")) {
+            config.sweep_min = ParseSize(arg.substr(12));
+        } else if (arg == "--sweep-min") {
+            Ensure(i + 1 < argc, "--sweep-min requires an argument");
+            config.sweep_min = ParseSize(argv[++i]);
+        } else if (HasPrefix(arg, "--sweep-max=")) {
+            config.sweep_max = ParseSize(arg.substr(12));
+        } else if (arg == "--sweep-max") {
+            Ensure(i + 1 < argc, "--sweep-max requires an argument");
+            config.sweep_max = ParseSize(argv[++i]);
+        } else if (HasPrefix(arg, "--threads=")) {
+            config.threads = static_cast<std::size_t>(std::strtoul(arg.c_str() + 10, NULL, 10));
+        } else if (arg == "--threads") {
+            Ensure(i + 1 < argc, "--threads requires an argument");
+            config.threads = static_cast<std::size_t>(std::strtoul(argv[++i], NULL, 10));
         } else if (arg == "--report") {
             Ensure(i + 1 < argc, "--report requires an argument");
             config.generate_report = true;
@@ -463,11 +2995,92 @@ ParseArgs(int argc, char** argv)
     if (config.measure_runs == 0) {
         config.measure_runs = 1;
     }
+    Ensure(config.compare.empty() || config.compare == "nlohmann",
+           "--compare only supports nlohmann");
+    Ensure(config.generate.empty() || ShapeByName(config.generate) >= 0,
+           "unknown shape: " + config.generate);
+    Ensure(config.sweep_min <= config.sweep_max, "--sweep-min exceeds --sweep-max");
     return config;
 }
 
 } // namespace bench
 
+void*
+operator new(std::size_t size)
+{
+    void* ptr = bench::CountedAlloc(size);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void*
+operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void*
+operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return bench::CountedAlloc(size);
+}
+
+void*
+operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return bench::CountedAlloc(size);
+}
+
+void
+operator delete(void* ptr) noexcept
+{
+    bench::CountedFree(ptr);
+}
+
+void
+operator delete[](void* ptr) noexcept
+{
+    bench::CountedFree(ptr);
+}
+
+void
+operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    bench::CountedFree(ptr);
+}
+
+#if defined(__cpp_sized_deallocation)
+void
+operator delete(void* ptr, std::size_t) noexcept
+{
+    bench::CountedFree(ptr);
+}
+
+void
+operator delete[](void* ptr, std::size_t) noexcept
+{
+    bench::CountedFree(ptr);
+}
+#endif
+
+void
+operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    bench::CountedFree(ptr);
+}
+
+struct BoundOrder
+{
+    long long id = 0;
+    std::string sku;
+    double price = 0;
+    long long quantity = 0;
+    std::vector<std::string> tags;
+};
+JT_FIELDS(BoundOrder, id, sku, price, quantity, tags)
+
 static const char kStoreExample[] =
   R"({
   "store": {
@@ -538,6 +3151,45 @@ main(int argc, char** argv)
 
     BenchConfig config = ParseArgs(argc, argv);
 
+    if (!config.generate.empty()) {
+        std::string doc = GenerateShape(static_cast<Shape>(ShapeByName(config.generate)),
+                                        config.gen_size,
+                                        config.seed);
+        std::fwrite(doc.data(), 1, doc.size(), stdout);
+        return 0;
+    }
+
+    if (config.sweep) {
+        std::vector<SweepSeries> series = RunSweep(config);
+        if (!series.empty()) {
+            PrintSweepReport(series, config.report_format);
+        }
+        return 0;
+    }
+
+    if (!config.replay.empty()) {
+        PrintReplayReport(RunReplay(config), config.report_format);
+        return 0;
+    }
+
+    if (config.cold) {
+        std::vector<ColdResult> results = RunCold(config);
+        if (!results.empty()) {
+            PrintColdReport(results, config.report_format);
+        }
+        return 0;
+    }
+
+    if (config.threads) {
+        std::vector<ThreadSeries> series = RunThreadScaling(config);
+        if (!series.empty()) {
+            PrintThreadReport(series,
+                              config.report_format,
+                              GenerateShape(kTwitter, config.gen_size, config.seed).size());
+        }
+        return 0;
+    }
+
     const std::string medium_orders_path =
       std::string(JTJSON_SOURCE_DIR) + "/benchmarks/corpus/medium_orders.json";
     const std::string large_orders_path =
@@ -555,6 +3207,44 @@ main(int argc, char** argv)
     const bench::Corpus valid_corpus = LoadCorpus(suite_dir, "y_", 0);
     const bench::Corpus invalid_corpus = LoadCorpus(suite_dir, "n_", 0);
 
+    if (config.memory) {
+        std::vector<MemoryInput> inputs;
+        MemoryInput input;
+        input.name = "memory.medium_orders";
+        input.texts.assign(1, medium_orders);
+        inputs.push_back(input);
+        input.name = "memory.large_orders";
+        input.texts.assign(1, large_orders);
+        inputs.push_back(input);
+        input.name = "memory.corpus_valid";
+        input.texts = valid_corpus.files;
+        inputs.push_back(input);
+        for (int s = 0; s < kShapes; ++s) {
+            input.name = std::string("memory.gen_") + kShapeNames[s];
+            input.texts.assign(1, GenerateShape(static_cast<Shape>(s), config.gen_size, config.seed));
+            inputs.push_back(input);
+        }
+        std::vector<MemoryResult> results;
+        for (std::size_t i = 0; i < inputs.size(); ++i) {
+            if (!config.filter.empty() && inputs[i].name.find(config.filter) == std::string::npos) {
+                continue;
+            }
+            if (config.list_only) {
+                std::printf("%s\n", inputs[i].name.c_str());
+                continue;
+            }
+            inputs[i].bytes = 0;
+            for (std::size_t j = 0; j < inputs[i].texts.size(); ++j) {
+                inputs[i].bytes += inputs[i].texts[j].size();
+            }
+            results.push_back(MeasureMemory(inputs[i], config.measure_runs));
+        }
+        if (!results.empty()) {
+            PrintMemoryReport(results, config.report_format);
+        }
+        return 0;
+    }
+
     jt::Json medium_orders_json = jt::Json::parse(medium_orders).second;
     jt::Json large_orders_json = jt::Json::parse(large_orders).second;
     std::pair<jt::Json::Status, jt::Json> jsonpath_parsed =
@@ -571,6 +3261,141 @@ main(int argc, char** argv)
     const std::size_t medium_pretty_bytes = medium_orders_json.toStringPretty().size();
     const std::size_t large_compact_bytes = large_orders_json.toString().size();
 
+    if (config.compare == "nlohmann") {
+        nlohmann::json nl_medium_orders = nlohmann::json::parse(medium_orders);
+        std::vector<ComparisonCase> comparisons;
+
+        comparisons.push_back({ "parse.small_literal",
+                                4000,
+                                store_literal_bytes,
+                                [&]() {
+                                    std::pair<jt::Json::Status, jt::Json> parsed =
+                                      jt::Json::parse(kStoreExample);
+                                    Ensure(parsed.first == jt::Json::success,
+                                           "parse.small_literal failed");
+                                    g_sink += parsed.second.isObject();
+                                },
+                                [&]() {
+                                    nlohmann::json parsed = nlohmann::json::parse(kStoreExample);
+                                    g_sink += parsed.is_object();
+                                } });
+
+        comparisons.push_back({ "parse.medium_orders",
+                                20,
+                                medium_orders_bytes,
+                                [&]() {
+                                    std::pair<jt::Json::Status, jt::Json> parsed =
+                                      jt::Json::parse(medium_orders);
+                                    Ensure(parsed.first == jt::Json::success,
+                                           "parse.medium_orders failed");
+                                    g_sink += parsed.second.isArray();
+                                },
+                                [&]() {
+                                    nlohmann::json parsed = nlohmann::json::parse(medium_orders);
+                                    g_sink += parsed.is_array();
+                                } });
+
+        comparisons.push_back({ "parse.large_orders",
+                                4,
+                                large_orders_bytes,
+                                [&]() {
+                                    std::pair<jt::Json::Status, jt::Json> parsed =
+                                      jt::Json::parse(large_orders);
+                                    Ensure(parsed.first == jt::Json::success,
+                                           "parse.large_orders failed");
+                                    g_sink += parsed.second.isArray();
+                                },
+                                [&]() {
+                                    nlohmann::json parsed = nlohmann::json::parse(large_orders);
+                                    g_sink += parsed.is_array();
+                                } });
+
+        comparisons.push_back({ "stringify.medium_compact",
+                                20,
+                                medium_compact_bytes,
+                                [&]() {
+                                    std::string out = medium_orders_json.toString();
+                                    DoNotOptimize(out);
+                                    g_sink += out.size();
+                                },
+                                [&]() {
+                                    std::string out = nl_medium_orders.dump();
+                                    DoNotOptimize(out);
+                                    g_sink += out.size();
+                                } });
+
+        comparisons.push_back({ "stringify.medium_pretty",
+                                20,
+                                medium_pretty_bytes,
+                                [&]() {
+                                    std::string out = medium_orders_json.toStringPretty();
+                                    DoNotOptimize(out);
+                                    g_sink += out.size();
+                                },
+                                [&]() {
+                                    std::string out = nl_medium_orders.dump(2);
+                                    DoNotOptimize(out);
+                                    g_sink += out.size();
+                                } });
+
+        comparisons.push_back({ "access.medium_prices",
+                                200,
+                                0,
+                                [&]() {
+                                    double total = 0;
+                                    for (jt::Json& item : medium_orders_json.getArray()) {
+                                        total += item["price"].getNumber();
+                                    }
+                                    g_sink += static_cast<std::uint64_t>(total);
+                                },
+                                [&]() {
+                                    double total = 0;
+                                    for (nlohmann::json& item : nl_medium_orders) {
+                                        total += item["price"].get<double>();
+                                    }
+                                    g_sink += static_cast<std::uint64_t>(total);
+                                } });
+
+        comparisons.push_back({ "copy.medium_object",
+                                50,
+                                0,
+                                [&]() {
+                                    jt::Json copied = medium_orders_json;
+                                    DoNotOptimize(copied);
+                                    g_sink += copied.isArray();
+                                },
+                                [&]() {
+                                    nlohmann::json copied = nl_medium_orders;
+                                    DoNotOptimize(copied);
+                                    g_sink += copied.is_array();
+                                } });
+
+        // Filter on the operation name so both halves of a pair always run.
+        BenchConfig pair_config = config;
+        pair_config.filter.clear();
+        Runner runner(pair_config);
+        for (std::size_t i = 0; i < comparisons.size(); ++i) {
+            const ComparisonCase& c = comparisons[i];
+            if (!config.filter.empty() && c.name.find(config.filter) == std::string::npos) {
+                continue;
+            }
+            runner.run({ c.name + "/jt",
+                         c.inner_iterations,
+                         c.bytes_per_iteration,
+                         std::function<void(std::size_t)>(),
+                         c.ours });
+            runner.run({ c.name + "/" + config.compare,
+                         c.inner_iterations,
+                         c.bytes_per_iteration,
+                         std::function<void(std::size_t)>(),
+                         c.theirs });
+        }
+        if (!config.list_only) {
+            PrintComparisonReport(runner.getResults(), config.compare, config.report_format);
+        }
+        return 0;
+    }
+
     std::vector<BenchCase> cases;
 
     cases.push_back({ "parse.small_literal",
@@ -895,6 +3720,156 @@ main(int argc, char** argv)
                           g_sink += copied.isArray();
                       } });
 
+    const std::vector<std::string> column_fields = { "id", "sku", "price", "quantity" };
+
+    cases.push_back({ "columns.project_large_orders",
+                      20,
+                      0,
+                      std::function<void(std::size_t)>(),
+                      [&]() {
+                          jt::Columns columns =
+                            jt::toColumns(large_orders_json, column_fields);
+                          g_sink += columns.rows;
+                      } });
+
+    cases.push_back({ "columns.parse_large_orders",
+                      4,
+                      large_orders_bytes,
+                      std::function<void(std::size_t)>(),
+                      [&]() {
+                          jt::Columns columns;
+                          Ensure(jt::parseColumns(large_orders, column_fields, columns) ==
+                                   jt::Json::success,
+                                 "columns.parse_large_orders failed");
+                          g_sink += columns.rows;
+                      } });
+
+    cases.push_back({ "bind.medium_orders",
+                      20,
+                      medium_orders_bytes,
+                      std::function<void(std::size_t)>(),
+                      [&]() {
+                          std::vector<BoundOrder> orders;
+                          Ensure(jt::parseInto(medium_orders, orders) == jt::Json::success,
+                                 "bind.medium_orders failed");
+                          g_sink += orders.size();
+                      } });
+
+    cases.push_back({ "bind.medium_orders_dom",
+                      20,
+                      medium_orders_bytes,
+                      std::function<void(std::size_t)>(),
+                      [&]() {
+                          std::pair<jt::Json::Status, jt::Json> parsed =
+                            jt::Json::parse(medium_orders);
+                          Ensure(parsed.first == jt::Json::success,
+                                 "bind.medium_orders_dom failed");
+                          std::vector<BoundOrder> orders;
+                          for (jt::Json& item : parsed.second.getArray()) {
+                              orders.emplace_back();
+                              BoundOrder& order = orders.back();
+                              order.id = item["id"].getLong();
+                              order.sku = item["sku"].getString();
+                              order.price = item["price"].getNumber();
+                              order.quantity = item["quantity"].getLong();
+                              for (const jt::Json& tag : item["tags"].getArray())
+                                  order.tags.push_back(tag.getString());
+                          }
+                          g_sink += orders.size();
+                      } });
+
+
+    // Generated shapes. Documents are built up front so every case of a
+    // shape sees identical bytes.
+    std::vector<std::string> shape_docs(kShapes);
+    std::vector<jt::Json> shape_json(kShapes);
+    std::vector<std::size_t> shape_compact_bytes(kShapes);
+    if (!config.list_only) {
+        for (int s = 0; s < kShapes; ++s) {
+            shape_docs[s] = GenerateShape(static_cast<Shape>(s), config.gen_size, config.seed);
+            std::pair<jt::Json::Status, jt::Json> parsed = jt::Json::parse(shape_docs[s]);
+            Ensure(parsed.first == jt::Json::success,
+                   std::string("generated ") + kShapeNames[s] + " does not parse: " +
+                     jt::Json::StatusToString(parsed.first));
+            shape_json[s] = std::move(parsed.second);
+            shape_compact_bytes[s] = shape_json[s].toString().size();
+        }
+    }
+    // Scale the loop counts so each case handles about 4 MB per run.
+    const std::size_t shape_inner = std::max<std::size_t>(1, (4u << 20) / config.gen_size);
+    for (int s = 0; s < kShapes; ++s) {
+        const std::string shape = kShapeNames[s];
+        cases.push_back({ "parse.gen_" + shape,
+                          shape_inner,
+                          shape_docs[s].size(),
+                          std::function<void(std::size_t)>(),
+                          [&shape_docs, s]() {
+                              std::pair<jt::Json::Status, jt::Json> parsed =
+                                jt::Json::parse(shape_docs[s]);
+                              Ensure(parsed.first == jt::Json::success, "parse.gen failed");
+                              g_sink += parsed.second.isObject();
+                          } });
+        cases.push_back({ "stringify.gen_" + shape,
+                          shape_inner,
+                          shape_compact_bytes[s],
+                          std::function<void(std::size_t)>(),
+                          [&shape_json, s]() {
+                              std::string out = shape_json[s].toString();
+                              DoNotOptimize(out);
+                              g_sink += out.size();
+                          } });
+        cases.push_back({ "jsonpath.gen_" + shape,
+                          shape_inner,
+                          0,
+                          std::function<void(std::size_t)>(),
+                          [&shape_json, s]() {
+                              const jt::Json& doc = shape_json[s];
+                              std::vector<const jt::Json*> matches =
+                                doc.jsonpath(ShapeQuery(static_cast<Shape>(s)));
+                              Ensure(!matches.empty(), "jsonpath.gen matched nothing");
+                              g_sink += matches.size();
+                          } });
+    }
+
+    const jt::Json& suite_json = shape_json[kTwitter];
+    for (std::size_t i = 0; i < sizeof(kJsonPathSuite) / sizeof(kJsonPathSuite[0]); ++i) {
+        const JsonPathSuiteCase& entry = kJsonPathSuite[i];
+        cases.push_back({ std::string("jsonpath.suite_") + entry.name,
+                          shape_inner,
+                          0,
+                          std::function<void(std::size_t)>(),
+                          [&suite_json, &entry]() {
+                              std::vector<const jt::Json*> matches =
+                                suite_json.jsonpath(entry.path);
+                              Ensure(!matches.empty(),
+                                     std::string("jsonpath.suite_") + entry.name +
+                                       " matched nothing");
+                              g_sink += matches.size();
+                          } });
+    }
+    std::vector<std::string> compile_paths;
+    for (std::size_t i = 0; i < kColdCompilePaths; ++i) {
+        compile_paths.push_back("$.statuses[" + std::to_string(i % 8) +
+                                "].user[?(@.followers_count > " + std::to_string(i) +
+                                ")].screen_name");
+    }
+    std::size_t compile_next = 0;
+    cases.push_back({ "jsonpath.suite_cache_hit",
+                      10000,
+                      0,
+                      std::function<void(std::size_t)>(),
+                      [&suite_json, &compile_paths]() {
+                          g_sink += suite_json.jsonpath(compile_paths[0]).size();
+                      } });
+    cases.push_back({ "jsonpath.suite_cold_compile",
+                      10000,
+                      0,
+                      std::function<void(std::size_t)>(),
+                      [&suite_json, &compile_paths, &compile_next]() {
+                          const std::string& path =
+                            compile_paths[compile_next++ % compile_paths.size()];
+                          g_sink += suite_json.jsonpath(path).size();
+                      } });
 
     if (config.list_only) {
         for (std::size_t i = 0; i < cases.size(); ++i) {
@@ -915,7 +3890,11 @@ main(int argc, char** argv)
         runner.run(cases[i]);
     }
 
-    if (config.generate_report) {
+    if (config.latency) {
+        PrintLatencyReport(runner.getLatencyResults(),
+                           config.generate_report ? config.report_format : "text",
+                           runner.timerOverhead());
+    } else if (config.generate_report) {
         const std::vector<BenchResult>& results = runner.getResults();
         if (config.report_format == "csv") {
             PrintCSVReport(results);
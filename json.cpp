@@ -19,22 +19,72 @@
 #include "jtckdint.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <chrono>
 #include <climits>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <regex>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "double-conversion/double-to-string.h"
 #include "double-conversion/string-to-double.h"
 
+// USDT probes for bpftrace, perf and SystemTap, in provider "jtjson".
+// They are built in whenever <sys/sdt.h> exists, unless JTJSON_NO_PROBES
+// is defined. An idle probe is a single nop. Arguments that take work to
+// compute, like node counts, are only computed while a tracer has the
+// probe's semaphore raised.
+#if !defined(JTJSON_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define JTJSON_PROBES
+#endif
+#endif
+
+#ifdef JTJSON_PROBES
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define PROBE_SEMAPHORE(name) \
+    volatile unsigned short jtjson_##name##_semaphore \
+      __attribute__((unused, section(".probes")))
+PROBE_SEMAPHORE(parse__entry);
+PROBE_SEMAPHORE(parse__return);
+PROBE_SEMAPHORE(stringify__entry);
+PROBE_SEMAPHORE(stringify__return);
+PROBE_SEMAPHORE(jsonpath__entry);
+PROBE_SEMAPHORE(jsonpath__return);
+PROBE_SEMAPHORE(update__entry);
+PROBE_SEMAPHORE(update__return);
+PROBE_SEMAPHORE(delete__entry);
+PROBE_SEMAPHORE(delete__return);
+PROBE_SEMAPHORE(compile__entry);
+PROBE_SEMAPHORE(compile__return);
+#define PROBE_ENABLED(name) (jtjson_##name##_semaphore != 0)
+#define PROBE1(name, a) DTRACE_PROBE1(jtjson, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(jtjson, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(jtjson, name, a, b, c)
+#else
+#define PROBE_ENABLED(name) false
+#define PROBE1(name, a) ((void)0)
+#define PROBE2(name, a, b) ((void)0)
+#define PROBE3(name, a, b, c) ((void)0)
+#endif
+
 #define KEY 1
 #define COMMA 2
 #define COLON 4
@@ -208,6 +258,35 @@ Bsr(int x)
 }
 #endif
 
+// Statistics hooks. Without JTJSON_STATS they expand to nothing, so a
+// normal build carries no trace of them.
+#ifdef JTJSON_STATS
+static thread_local Stats* tStats;
+#define STAT_ADD(field, n) \
+    (tStats ? (void)(tStats->field += (n)) : (void)0)
+#define STAT_MAX(field, n) \
+    (tStats && tStats->field < (n) ? (void)(tStats->field = (n)) : (void)0)
+#else
+#define STAT_ADD(field, n) ((void)0)
+#define STAT_MAX(field, n) ((void)0)
+#endif
+
+#ifdef JTJSON_PROBES
+static size_t
+CountNodes(const Json& json)
+{
+    size_t n = 1;
+    if (json.isArray()) {
+        for (const Json& element : json.getArray())
+            n += CountNodes(element);
+    } else if (json.isObject()) {
+        for (const auto& member : json.getObject())
+            n += CountNodes(member.second);
+    }
+    return n;
+}
+#endif
+
 static double
 StringToDouble(const char* s, size_t n, int* out_processed)
 {
@@ -631,16 +710,28 @@ Json::operator[](const std::string& key)
 std::string
 Json::toString() const
 {
+    PROBE1(stringify__entry, 0);
     std::string b;
     marshal(b, false, 0);
+    STAT_ADD(documentsWritten, 1);
+    STAT_ADD(bytesWritten, b.size());
+    PROBE2(stringify__return,
+           b.size(),
+           PROBE_ENABLED(stringify__return) ? CountNodes(*this) : 0);
     return b;
 }
 
 std::string
 Json::toStringPretty() const
 {
+    PROBE1(stringify__entry, 1);
     std::string b;
     marshal(b, true, 0);
+    STAT_ADD(documentsWritten, 1);
+    STAT_ADD(bytesWritten, b.size());
+    PROBE2(stringify__return,
+           b.size(),
+           PROBE_ENABLED(stringify__return) ? CountNodes(*this) : 0);
     return b;
 }
 
@@ -667,6 +758,7 @@ Json::marshal(std::string& b, bool pretty, int indent) const
             double_conversion::StringBuilder db(buf, 128);
             kDoubleToJson.ToShortestSingle(float_value, &db);
             db.Finalize();
+            STAT_ADD(doublesFormatted, 1);
             b += buf;
             break;
         }
@@ -675,6 +767,7 @@ Json::marshal(std::string& b, bool pretty, int indent) const
             double_conversion::StringBuilder db(buf, 128);
             kDoubleToJson.ToShortest(double_value, &db);
             db.Finalize();
+            STAT_ADD(doublesFormatted, 1);
             b += buf;
             break;
         }
@@ -767,7 +860,7 @@ Json::serialize(std::string& sb, const std::string& s)
         switch (0 <= x && x <= 127 ? kEscapeLiteral[x] : 9) {
             case 0:
                 sb += x;
-                break;
+                continue;
             case 1:
                 sb += "\\t";
                 break;
@@ -805,6 +898,7 @@ Json::serialize(std::string& sb, const std::string& s)
             default:
                 ON_LOGIC_ERROR("Unhandled character escape code during string serialization.");
         }
+        STAT_ADD(escapesEncoded, 1);
     }
 }
 
@@ -849,6 +943,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                     goto OnColonCommaKey;
                 if (p + 3 <= e && READ32LE(p - 1) == READ32LE("null")) {
                     p += 3;
+                    STAT_ADD(nulls, 1);
                     return success;
                 } else {
                     return illegal_character;
@@ -861,6 +956,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                     json.type_ = Bool;
                     json.bool_value = false;
                     p += 4;
+                    STAT_ADD(bools, 1);
                     return success;
                 } else {
                     return illegal_character;
@@ -873,6 +969,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                     json.type_ = Bool;
                     json.bool_value = true;
                     p += 3;
+                    STAT_ADD(bools, 1);
                     return success;
                 } else {
                     return illegal_character;
@@ -915,6 +1012,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                 }
                 json.type_ = Long;
                 json.long_value = 0;
+                STAT_ADD(longs, 1);
                 return success;
 
             case '1':
@@ -933,6 +1031,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                     if (isdigit(c)) {
                         if (ckd_mul(&x, x, 10) ||
                             ckd_add(&x, x, (c - '0') * d)) {
+                            STAT_ADD(longOverflows, 1);
                             goto UseDubble;
                         }
                     } else if (c == '.') {
@@ -947,6 +1046,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                 }
                 json.type_ = Long;
                 json.long_value = x;
+                STAT_ADD(longs, 1);
                 return success;
 
             UseDubble: // number
@@ -957,12 +1057,15 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                 if (a + c < e && (a[c] == 'e' || a[c] == 'E'))
                     return bad_exponent;
                 p = a + c;
+                STAT_ADD(doubles, 1);
                 return success;
 
             case '[': { // Array
                 if (context & (COLON | COMMA | KEY))
                     goto OnColonCommaKey;
                 json.setArray();
+                STAT_ADD(arrays, 1);
+                STAT_MAX(maxDepth, DEPTH - depth + 1);
                 Json value;
                 for (context = ARRAY, i = 0;;) {
                     Status status = parse(value, p, e, context, depth - 1);
@@ -989,6 +1092,8 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                 if (context & (COLON | COMMA | KEY))
                     goto OnColonCommaKey;
                 json.setObject();
+                STAT_ADD(objects, 1);
+                STAT_MAX(maxDepth, DEPTH - depth + 1);
                 context = KEY | OBJECT;
                 Json key, value;
                 for (;;) {
@@ -999,6 +1104,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                         return status;
                     if (!key.isString())
                         return object_key_must_be_string;
+                    STAT_ADD(keys, 1);
                     status = parse(value, p, e, COLON, depth - 1);
                     if (status == absent_value)
                         return object_missing_value;
@@ -1027,11 +1133,13 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                         case DQUOTE:
                             json.type_ = String;
                             new (&json.string_value) std::string(std::move(b));
+                            STAT_ADD(strings, 1);
                             return success;
 
                         case BACKSLASH:
                             if (p >= e)
                                 return unexpected_end_of_string;
+                            STAT_ADD(escapesDecoded, 1);
                             switch ((c = *p++ & 255)) {
                                 case '"':
                                 case '/':
@@ -1150,6 +1258,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                                 c = (c & 037) << 6 | //
                                     (p[0] & 077); //
                                 p += 1;
+                                STAT_ADD(utf8Sequences, 1);
                                 goto EncodeUtf8;
                             } else {
                                 return malformed_utf8;
@@ -1173,6 +1282,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                                     (p[0] & 077) << 6 | //
                                     (p[1] & 077); //
                                 p += 2;
+                                STAT_ADD(utf8Sequences, 1);
                                 goto EncodeUtf8;
                             } else {
                                 return malformed_utf8;
@@ -1195,6 +1305,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                                         (p[4] & 077); //
                                     c = ((A - 0xDB80) << 10) + //
                                         ((B - 0xDC00) + 0x10000); //
+                                    STAT_ADD(utf8Sequences, 1);
                                     goto EncodeUtf8;
                                 } else if ((p[0] & 0300) == 0200 && //
                                            (p[1] & 0300) == 0200) { //
@@ -1231,6 +1342,7 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
                                 if (A <= 0x10FFFF) {
                                     c = A;
                                     p += 3;
+                                    STAT_ADD(utf8Sequences, 1);
                                     goto EncodeUtf8;
                                 } else {
                                     return utf8_exceeds_utf16_range;
@@ -1263,11 +1375,20 @@ Json::parse(Json& json, const char*& p, const char* e, int context, int depth)
 
 std::pair<Json::Status, Json>
 Json::parse(const std::string& s)
+{
+    return parse(s.data(), s.size());
+}
+
+std::pair<Json::Status, Json>
+Json::parse(const char* data, size_t size)
 {
     Json::Status s2;
     std::pair<Json::Status, Json> res;
-    const char* p = s.data();
-    const char* e = s.data() + s.size();
+    const char* p = data;
+    const char* e = data + size;
+    PROBE2(parse__entry, data, size);
+    STAT_ADD(documents, 1);
+    STAT_ADD(bytesParsed, size);
     res.first = parse(res.second, p, e, 0, DEPTH);
     if (res.first == Json::success) {
         Json j2;
@@ -1275,9 +1396,169 @@ Json::parse(const std::string& s)
         if (s2 != absent_value)
             res.first = trailing_content;
     }
+    PROBE3(parse__return,
+           size,
+           static_cast<int>(res.first),
+           PROBE_ENABLED(parse__return) ? CountNodes(res.second) : 0);
     return res;
 }
 
+// Moves p past one value like parse() does, with the same statuses, but
+// builds nothing. Plain ASCII strings are only scanned; one holding an
+// escape or UTF-8 is handed to parse() to be checked. Sets *string if
+// the value was a string.
+Json::Status
+Json::skip(const char*& p, const char* e, int context, int depth, bool* string)
+{
+    if (!depth)
+        return depth_exceeded;
+    for (;;) {
+        while (p < e && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+            ++p;
+        if (p == e)
+            return depth == DEPTH ? absent_value : unexpected_eof;
+        switch (*p) {
+            case ',':
+                if (!(context & COMMA))
+                    return unexpected_comma;
+                context = 0;
+                ++p;
+                break;
+
+            case ':':
+                if (!(context & COLON))
+                    return unexpected_colon;
+                context = 0;
+                ++p;
+                break;
+
+            case ']':
+                if (!(context & ARRAY))
+                    return unexpected_end_of_array;
+                ++p;
+                return absent_value;
+
+            case '}':
+                if (!(context & OBJECT))
+                    return unexpected_end_of_object;
+                ++p;
+                return absent_value;
+
+            case '[':
+            case '{': {
+                if (context & KEY)
+                    return object_key_must_be_string;
+                if (context & COLON)
+                    return missing_colon;
+                if (context & COMMA)
+                    return missing_comma;
+                bool object = *p++ == '{';
+                context = object ? KEY | OBJECT : ARRAY;
+                for (;;) {
+                    bool key = false;
+                    Status status = skip(p, e, context, depth - 1, &key);
+                    if (status == absent_value)
+                        return success;
+                    if (status != success)
+                        return status;
+                    if (object) {
+                        if (!key)
+                            return object_key_must_be_string;
+                        status = skip(p, e, COLON, depth - 1);
+                        if (status == absent_value)
+                            return object_missing_value;
+                        if (status != success)
+                            return status;
+                        context = KEY | COMMA | OBJECT;
+                    } else {
+                        context = ARRAY | COMMA;
+                    }
+                }
+            }
+
+            case '"':
+                if (context & COLON)
+                    return missing_colon;
+                if (context & COMMA)
+                    return missing_comma;
+                for (const char* q = p + 1;;) {
+                    if (q == e)
+                        return unexpected_end_of_string;
+                    int c = *q++ & 255;
+                    if (c == '"') {
+                        p = q;
+                        break;
+                    }
+                    if (c < 0x20)
+                        return non_del_c0_control_code_in_string;
+                    if (c == '\\' || c >= 0x80) {
+                        Json scalar;
+                        Status status = parse(scalar, p, e, context, depth);
+                        if (string)
+                            *string = true;
+                        return status;
+                    }
+                }
+                if (string)
+                    *string = true;
+                return success;
+
+            default: {
+                Json scalar;
+                return parse(scalar, p, e, context, depth);
+            }
+        }
+    }
+}
+
+bool
+statsEnabled()
+{
+#ifdef JTJSON_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+Stats*
+setStats(Stats* stats)
+{
+#ifdef JTJSON_STATS
+    Stats* previous = tStats;
+    tStats = stats;
+    return previous;
+#else
+    (void)stats;
+    return nullptr;
+#endif
+}
+
+Json
+Stats::toJson() const
+{
+    Json json;
+    json["documents"] = static_cast<long long>(documents);
+    json["bytesParsed"] = static_cast<long long>(bytesParsed);
+    json["nulls"] = static_cast<long long>(nulls);
+    json["bools"] = static_cast<long long>(bools);
+    json["longs"] = static_cast<long long>(longs);
+    json["doubles"] = static_cast<long long>(doubles);
+    json["strings"] = static_cast<long long>(strings);
+    json["keys"] = static_cast<long long>(keys);
+    json["arrays"] = static_cast<long long>(arrays);
+    json["objects"] = static_cast<long long>(objects);
+    json["escapesDecoded"] = static_cast<long long>(escapesDecoded);
+    json["utf8Sequences"] = static_cast<long long>(utf8Sequences);
+    json["longOverflows"] = static_cast<long long>(longOverflows);
+    json["maxDepth"] = maxDepth;
+    json["documentsWritten"] = static_cast<long long>(documentsWritten);
+    json["bytesWritten"] = static_cast<long long>(bytesWritten);
+    json["escapesEncoded"] = static_cast<long long>(escapesEncoded);
+    json["doublesFormatted"] = static_cast<long long>(doublesFormatted);
+    return json;
+}
+
 namespace detail {
 
 struct JsonPathSlice
@@ -1298,6 +1579,16 @@ enum class JsonPathUnionKind
     Wildcard
 };
 
+enum class JsonPathAggregate
+{
+    None,
+    Sum,
+    Min,
+    Max,
+    Avg,
+    Distinct
+};
+
 struct JsonPathUnionEntry
 {
     JsonPathUnionKind kind = JsonPathUnionKind::Wildcard;
@@ -1327,12 +1618,16 @@ struct JsonPathStep
     JsonPathSlice slice;
     std::vector<JsonPathUnionEntry> unionEntries;
     std::shared_ptr<FilterNode> filter;
+    size_t filterCacheSlots = 0;
+    size_t filterOperandSlots = 0;
+    std::string text;
 };
 
 struct CompiledPath
 {
     bool relative = false;
     std::vector<JsonPathStep> steps;
+    JsonPathAggregate aggregate = JsonPathAggregate::None;
 };
 
 struct FilterOperand
@@ -1350,10 +1645,12 @@ struct FilterOperand
         {
             Length,
             Size,
-            Count
+            Count,
+            Aggregate
         };
 
         Name name = Name::Length;
+        JsonPathAggregate aggregate = JsonPathAggregate::None;
         std::vector<FilterOperand> args;
     };
 
@@ -1361,6 +1658,7 @@ struct FilterOperand
     Json literal;
     CompiledPath path;
     std::shared_ptr<FunctionCall> function;
+    int cacheSlot = -1;
 };
 
 struct FilterNode
@@ -1381,6 +1679,12 @@ struct FilterNode
     FilterOperand existsOperand;
     std::shared_ptr<FilterNode> left;
     std::shared_ptr<FilterNode> right;
+
+    // Filled in by FilterPlanner after the expression is parsed.
+    bool invariant = false;
+    int cacheSlot = -1;
+    double cost = 0;
+    double selectivity = 0.5;
 };
 
 #if defined(__GNUC__) || defined(__clang__)
@@ -1398,6 +1702,26 @@ prefetch(const void*)
 
 constexpr size_t kPrefetchDistance = 4;
 
+// Makes room for `extra` more elements, growing capacity geometrically.
+// Reserving an exact size each time would reallocate on every small
+// append, which made recursive descent through deeply nested
+// one-element arrays quadratic.
+template <typename Sink>
+static inline void
+reserveMore(Sink& out, size_t extra)
+{
+    out.reserve(out.size() + extra);
+}
+
+template <typename T>
+static inline void
+reserveMore(std::vector<T>& out, size_t extra)
+{
+    const size_t wanted = out.size() + extra;
+    if (wanted > out.capacity())
+        out.reserve(std::max(wanted, out.capacity() * 2));
+}
+
 static int
 hexValue(char c)
 {
@@ -1556,6 +1880,7 @@ class JsonPathParser
     JsonPathStep parseSegment();
     JsonPathStep parseBracket(bool recursive);
     JsonPathUnionEntry parseBracketEntry();
+    bool parseAggregate(CompiledPath& result);
     std::shared_ptr<FilterNode> parseFilterExpression(const std::string& expression);
     [[noreturn]] void error(const std::string& message) const;
 };
@@ -1624,6 +1949,32 @@ class FilterExpressionParser
     [[noreturn]] void error(const std::string& message) const;
 };
 
+// Rewrites a parsed filter so the per-candidate loop does less work:
+// commutative && / || chains are reordered by estimated cost and
+// selectivity, and subtrees or operands that never look at '@' are given
+// a cache slot so they are evaluated once per step instead of once per
+// node.
+class FilterPlanner
+{
+  public:
+    static void plan(JsonPathStep& step);
+
+  private:
+    static void optimize(std::shared_ptr<FilterNode>& node);
+    static void flatten(const std::shared_ptr<FilterNode>& node,
+                        FilterNode::Kind kind,
+                        std::vector<std::shared_ptr<FilterNode>>& out);
+    static void combine(FilterNode& node);
+    static double rank(const FilterNode& node, FilterNode::Kind kind);
+    static void assignSlots(FilterNode& node, JsonPathStep& step);
+    static void assignOperandSlots(FilterOperand& operand, JsonPathStep& step);
+    static bool operandInvariant(const FilterOperand& operand);
+    static double operandCost(const FilterOperand& operand);
+    static double pathCost(const CompiledPath& path);
+    static double comparisonCost(const std::string& op);
+    static double comparisonSelectivity(const std::string& op);
+};
+
 
 void
 JsonPathParser::skipWhitespace()
@@ -1703,11 +2054,223 @@ JsonPathParser::parse()
         skipWhitespace();
         if (pos_ >= input_.size())
             break;
+        if (parseAggregate(result))
+            break;
+        const size_t segmentStart = pos_;
         result.steps.emplace_back(parseSegment());
+        result.steps.back().text = input_.substr(segmentStart, pos_ - segmentStart);
     }
     return result;
 }
 
+static JsonPathAggregate
+aggregateByName(const std::string& name)
+{
+    std::string lowered;
+    lowered.resize(name.size());
+    std::transform(name.begin(), name.end(), lowered.begin(), [](unsigned char ch) {
+        return static_cast<char>(std::tolower(ch));
+    });
+    if (lowered == "sum")
+        return JsonPathAggregate::Sum;
+    if (lowered == "min")
+        return JsonPathAggregate::Min;
+    if (lowered == "max")
+        return JsonPathAggregate::Max;
+    if (lowered == "avg")
+        return JsonPathAggregate::Avg;
+    if (lowered == "distinct")
+        return JsonPathAggregate::Distinct;
+    return JsonPathAggregate::None;
+}
+
+bool
+JsonPathParser::parseAggregate(CompiledPath& result)
+{
+    // A trailing .sum() style call turns the node list into a single value.
+    size_t start = pos_;
+    if (input_[pos_] != '.')
+        return false;
+    ++pos_;
+    if (pos_ >= input_.size() ||
+        !std::isalpha(static_cast<unsigned char>(input_[pos_]))) {
+        pos_ = start;
+        return false;
+    }
+    std::string name = parseIdentifier();
+    skipWhitespace();
+    if (pos_ >= input_.size() || input_[pos_] != '(') {
+        pos_ = start;
+        return false;
+    }
+    ++pos_;
+    skipWhitespace();
+    if (pos_ >= input_.size() || input_[pos_] != ')')
+        error("Aggregate functions take no arguments");
+    ++pos_;
+    result.aggregate = aggregateByName(name);
+    if (result.aggregate == JsonPathAggregate::None)
+        error("Unsupported aggregate function");
+    skipWhitespace();
+    if (pos_ < input_.size())
+        error("Aggregate function must end the expression");
+    return true;
+}
+
+static thread_local JsonPathProfiler* tProfiler;
+static thread_local JsonPathProfiler::Query* tQuery;
+
+static uint64_t
+profileNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Collects one top-level query for the installed profiler. Only the
+// outermost scope on a thread records. A nested scope, like jsonpath()
+// inside updateJsonpath(), adds its steps to the outer query, so the
+// update is counted once and timed with its assignments. Filter
+// subpaths never open a scope and are never counted.
+class ProfiledQuery
+{
+  public:
+    explicit ProfiledQuery(const std::string& expression)
+      : expression_(expression)
+    {
+        if (tProfiler && !tQuery) {
+            profiler_ = tProfiler;
+            tQuery = &query_;
+            started_ = profileNanos();
+        } else {
+            outer_ = tQuery;
+        }
+    }
+
+    ~ProfiledQuery()
+    {
+        if (profiler_)
+            tQuery = nullptr;
+    }
+
+    JsonPathProfiler::Query* query()
+    {
+        return profiler_ ? &query_ : outer_;
+    }
+
+    void finish();
+
+  private:
+    const std::string& expression_;
+    JsonPathProfiler* profiler_ = nullptr;
+    JsonPathProfiler::Query* outer_ = nullptr;
+    JsonPathProfiler::Query query_;
+    uint64_t started_ = 0;
+};
+
+// Fires the return probe of a JSONPath call or compile on every way out,
+// so tracers pairing it with the entry probe never leak a start time.
+// The status is 0 once done() is called and -1 if an exception escaped.
+class ProbedQuery
+{
+  public:
+    enum Kind
+    {
+        Query,
+        Update,
+        Delete,
+        Compile
+    };
+
+    ProbedQuery(Kind kind, const std::string& expression)
+      : kind_(kind), expression_(expression.c_str())
+    {
+        switch (kind_) {
+            case Query:
+                PROBE1(jsonpath__entry, expression_);
+                break;
+            case Update:
+                PROBE1(update__entry, expression_);
+                break;
+            case Delete:
+                PROBE1(delete__entry, expression_);
+                break;
+            case Compile:
+                PROBE1(compile__entry, expression_);
+                break;
+        }
+    }
+
+    ~ProbedQuery()
+    {
+        switch (kind_) {
+            case Query:
+                PROBE3(jsonpath__return, expression_, count_, status_);
+                break;
+            case Update:
+                PROBE3(update__return, expression_, count_, status_);
+                break;
+            case Delete:
+                PROBE3(delete__return, expression_, count_, status_);
+                break;
+            case Compile:
+                PROBE3(compile__return, expression_, count_, status_);
+                break;
+        }
+    }
+
+    void done(size_t count)
+    {
+        count_ = count;
+        status_ = 0;
+    }
+
+  private:
+    Kind kind_;
+    const char* expression_;
+    size_t count_ = 0;
+    int status_ = -1;
+};
+
+void
+ProfiledQuery::finish()
+{
+    if (!profiler_)
+        return;
+    JsonPathProfiler* profiler = profiler_;
+    profiler_ = nullptr;
+    tQuery = nullptr;
+    query_.nanos = profileNanos() - started_;
+    JsonPathProfiler::Expression& entry = profiler->expressions[expression_];
+    ++entry.evaluations;
+    if (query_.compileNanos)
+        ++entry.compiles;
+    entry.nanos += query_.nanos;
+    entry.maxNanos = std::max(entry.maxNanos, query_.nanos);
+    entry.compileNanos += query_.compileNanos;
+    entry.matches += query_.matches;
+    if (entry.steps.size() < query_.steps.size())
+        entry.steps.resize(query_.steps.size());
+    for (size_t i = 0; i < query_.steps.size(); ++i) {
+        const JsonPathProfiler::Step& step = query_.steps[i];
+        JsonPathProfiler::Step& total = entry.steps[i];
+        if (total.selector.empty())
+            total.selector = step.selector;
+        total.frontier += step.frontier;
+        total.maxFrontier = std::max(total.maxFrontier, step.frontier);
+        total.nodesVisited += step.nodesVisited;
+        total.filterEvaluations += step.filterEvaluations;
+        total.matches += step.matches;
+        total.nanos += step.nanos;
+    }
+    if (!profiler->slowQueryNanos || query_.nanos < profiler->slowQueryNanos)
+        return;
+    ++entry.slowQueries;
+    if (profiler->onSlowQuery)
+        profiler->onSlowQuery(expression_, query_);
+}
+
 class JsonPathCache
 {
   public:
@@ -1719,10 +2282,16 @@ class JsonPathCache
             it->second.lastUsedTick = now;
             return it->second.path;
         }
+        ProbedQuery probe(ProbedQuery::Compile, expression);
+        JsonPathProfiler::Query* query = tQuery;
+        const uint64_t compileStart = query ? profileNanos() : 0;
         JsonPathParser parser(expression);
         CacheEntry entry;
         entry.path = parser.parse();
         entry.lastUsedTick = now;
+        if (query)
+            query->compileNanos = std::max<uint64_t>(1, profileNanos() - compileStart);
+        probe.done(entry.path.steps.size());
         auto [insertedIt, inserted] = cache_.emplace(expression, std::move(entry));
         if (cache_.size() > kMaxEntries)
             evictOldest();
@@ -1844,6 +2413,7 @@ JsonPathParser::parseBracket(bool recursive)
         step.kind = JsonPathStep::Kind::Filter;
         step.recursive = recursive;
         step.filter = parseFilterExpression(filterExpr);
+        FilterPlanner::plan(step);
         return step;
     }
     if (input_[pos_] == '*') {
@@ -2323,6 +2893,9 @@ FilterExpressionParser::parseFunctionCall(const std::string& name)
         operand.function->name = FilterOperand::FunctionCall::Name::Length;
     } else if (lowered == "count") {
         operand.function->name = FilterOperand::FunctionCall::Name::Count;
+    } else if (aggregateByName(lowered) != JsonPathAggregate::None) {
+        operand.function->name = FilterOperand::FunctionCall::Name::Aggregate;
+        operand.function->aggregate = aggregateByName(lowered);
     } else {
         error("Unsupported function in filter expression");
     }
@@ -2356,6 +2929,12 @@ FilterExpressionParser::parsePathLiteral()
             ++pos_;
             continue;
         }
+        if (c == '(' && bracketDepth == 0 && pos_ + 1 < input_.size() &&
+            input_[pos_ + 1] == ')') {
+            // Trailing aggregate call, e.g. @.items[*].price.sum()
+            pos_ += 2;
+            break;
+        }
         if (c == ']') {
             if (bracketDepth == 0)
                 break;
@@ -2377,88 +2956,303 @@ FilterExpressionParser::parsePathLiteral()
     return input_.substr(start, pos_ - start);
 }
 
-template <typename JsonType>
-struct JsonAccessor;
-
-template <>
-struct JsonAccessor<Json>
+void
+FilterPlanner::plan(JsonPathStep& step)
 {
-    using Pointer = Json*;
-    using ArrayType = std::vector<Json>;
-    using ObjectType = std::map<std::string, Json>;
-
-    static bool isArray(const Json& value) { return value.isArray(); }
-    static bool isObject(const Json& value) { return value.isObject(); }
-    static ArrayType& getArray(Json& value) { return value.getArray(); }
-    static ObjectType& getObject(Json& value) { return value.getObject(); }
-};
+    if (!step.filter)
+        return;
+    optimize(step.filter);
+    assignSlots(*step.filter, step);
+}
 
-template <>
-struct JsonAccessor<const Json>
+void
+FilterPlanner::optimize(std::shared_ptr<FilterNode>& node)
 {
-    using Pointer = const Json*;
-    using ArrayType = const std::vector<Json>;
-    using ObjectType = const std::map<std::string, Json>;
-
-    static bool isArray(const Json& value) { return value.isArray(); }
-    static bool isObject(const Json& value) { return value.isObject(); }
-    static const ArrayType& getArray(const Json& value) { return value.getArray(); }
-    static const ObjectType& getObject(const Json& value) { return value.getObject(); }
-};
+    switch (node->kind) {
+        case FilterNode::Kind::Or:
+        case FilterNode::Kind::And: {
+            // Both operators are commutative once the chain is flattened, so
+            // cheap and decisive operands can run first and short-circuit the
+            // rest. The sort is stable to keep the written order on ties.
+            const FilterNode::Kind kind = node->kind;
+            std::vector<std::shared_ptr<FilterNode>> terms;
+            flatten(node, kind, terms);
+            for (auto& term : terms)
+                optimize(term);
+            std::stable_sort(terms.begin(),
+                             terms.end(),
+                             [kind](const std::shared_ptr<FilterNode>& a,
+                                    const std::shared_ptr<FilterNode>& b) {
+                                 return rank(*a, kind) < rank(*b, kind);
+                             });
+            std::shared_ptr<FilterNode> chain = terms.front();
+            for (size_t i = 1; i < terms.size(); ++i) {
+                auto parent = std::make_shared<FilterNode>();
+                parent->kind = kind;
+                parent->left = chain;
+                parent->right = terms[i];
+                combine(*parent);
+                chain = parent;
+            }
+            node = chain;
+            break;
+        }
+        case FilterNode::Kind::Not:
+            optimize(node->left);
+            node->invariant = node->left->invariant;
+            node->cost = node->left->cost;
+            node->selectivity = 1.0 - node->left->selectivity;
+            break;
+        case FilterNode::Kind::Comparison:
+            node->invariant =
+              operandInvariant(node->lhs) && operandInvariant(node->rhs);
+            node->cost = operandCost(node->lhs) + operandCost(node->rhs) +
+                         comparisonCost(node->comparisonOp);
+            node->selectivity = comparisonSelectivity(node->comparisonOp);
+            break;
+        case FilterNode::Kind::Exists:
+            node->invariant = operandInvariant(node->existsOperand);
+            node->cost = operandCost(node->existsOperand) + 1;
+            node->selectivity = 0.5;
+            break;
+    }
+}
 
-static bool
-normalizeIndex(long long index, size_t size, size_t& out)
+void
+FilterPlanner::flatten(const std::shared_ptr<FilterNode>& node,
+                       FilterNode::Kind kind,
+                       std::vector<std::shared_ptr<FilterNode>>& out)
 {
-    long long normalized = index;
-    if (normalized < 0)
-        normalized += static_cast<long long>(size);
-    if (normalized < 0 || normalized >= static_cast<long long>(size))
-        return false;
-    out = static_cast<size_t>(normalized);
-    return true;
+    if (node->kind == kind) {
+        flatten(node->left, kind, out);
+        flatten(node->right, kind, out);
+    } else {
+        out.push_back(node);
+    }
 }
 
-template <typename JsonType>
-static void
-collectDescendants(JsonType* node,
-                   std::vector<JsonType*>& out,
-                   std::vector<JsonType*>& stack)
+void
+FilterPlanner::combine(FilterNode& node)
 {
-    stack.clear();
-    stack.push_back(node);
-    while (!stack.empty()) {
-        JsonType* current = stack.back();
-        stack.pop_back();
-        out.push_back(current);
-        if (current->isArray()) {
-            auto& arr = JsonAccessor<JsonType>::getArray(*current);
-            const size_t arrSize = arr.size();
-            if (arrSize > 0) {
-                out.reserve(out.size() + arrSize);
-                stack.reserve(stack.size() + arrSize);
-                for (size_t i = arrSize; i-- > 0;)
-                    stack.push_back(&arr[i]);
-            }
-        } else if (current->isObject()) {
-            auto& obj = JsonAccessor<JsonType>::getObject(*current);
-            const size_t objSize = obj.size();
-            if (objSize > 0) {
-                out.reserve(out.size() + objSize);
-                stack.reserve(stack.size() + objSize);
-                for (auto it = obj.rbegin(); it != obj.rend(); ++it)
-                    stack.push_back(&it->second);
-            }
-        }
+    const FilterNode& l = *node.left;
+    const FilterNode& r = *node.right;
+    node.invariant = l.invariant && r.invariant;
+    if (node.kind == FilterNode::Kind::And) {
+        node.cost = l.cost + l.selectivity * r.cost;
+        node.selectivity = l.selectivity * r.selectivity;
+    } else {
+        node.cost = l.cost + (1.0 - l.selectivity) * r.cost;
+        node.selectivity =
+          1.0 - (1.0 - l.selectivity) * (1.0 - r.selectivity);
     }
 }
 
-template <typename JsonType>
-static void
-applySlice(JsonType* node, const JsonPathSlice& slice, std::vector<JsonType*>& out)
+double
+FilterPlanner::rank(const FilterNode& node, FilterNode::Kind kind)
 {
-    if (!node->isArray())
-        return;
-    auto& arr = JsonAccessor<JsonType>::getArray(*node);
+    // An invariant term is computed once per step and then served from the
+    // cache, so for ordering purposes it is nearly free.
+    const double cost = node.invariant ? 1.0 : node.cost;
+    const double decisive =
+      kind == FilterNode::Kind::And ? 1.0 - node.selectivity : node.selectivity;
+    if (decisive <= 0.0)
+        return std::numeric_limits<double>::infinity();
+    return cost / decisive;
+}
+
+void
+FilterPlanner::assignSlots(FilterNode& node, JsonPathStep& step)
+{
+    if (node.invariant) {
+        node.cacheSlot = static_cast<int>(step.filterCacheSlots++);
+        return;
+    }
+    switch (node.kind) {
+        case FilterNode::Kind::Or:
+        case FilterNode::Kind::And:
+            assignSlots(*node.left, step);
+            assignSlots(*node.right, step);
+            break;
+        case FilterNode::Kind::Not:
+            assignSlots(*node.left, step);
+            break;
+        case FilterNode::Kind::Comparison:
+            assignOperandSlots(node.lhs, step);
+            assignOperandSlots(node.rhs, step);
+            break;
+        case FilterNode::Kind::Exists:
+            assignOperandSlots(node.existsOperand, step);
+            break;
+    }
+}
+
+void
+FilterPlanner::assignOperandSlots(FilterOperand& operand, JsonPathStep& step)
+{
+    // The node itself depends on '@', but a side like $.maxPrice does not.
+    // Caching it saves a walk from the root (or a literal copy) for every
+    // candidate.
+    if (operandInvariant(operand)) {
+        operand.cacheSlot = static_cast<int>(step.filterOperandSlots++);
+        return;
+    }
+    if (operand.type == FilterOperand::Type::Function) {
+        for (auto& arg : operand.function->args)
+            assignOperandSlots(arg, step);
+    }
+}
+
+bool
+FilterPlanner::operandInvariant(const FilterOperand& operand)
+{
+    switch (operand.type) {
+        case FilterOperand::Type::Literal:
+            return true;
+        case FilterOperand::Type::Path:
+            return !operand.path.relative;
+        case FilterOperand::Type::Function:
+            for (const auto& arg : operand.function->args) {
+                if (!operandInvariant(arg))
+                    return false;
+            }
+            return true;
+    }
+    return false;
+}
+
+double
+FilterPlanner::operandCost(const FilterOperand& operand)
+{
+    // Invariant operands are served from the step's cache after the first
+    // candidate.
+    if (operandInvariant(operand))
+        return 1;
+    switch (operand.type) {
+        case FilterOperand::Type::Literal:
+            return 1;
+        case FilterOperand::Type::Path:
+            return pathCost(operand.path);
+        case FilterOperand::Type::Function: {
+            double cost = 1;
+            for (const auto& arg : operand.function->args)
+                cost += operandCost(arg);
+            return cost;
+        }
+    }
+    return 1;
+}
+
+double
+FilterPlanner::pathCost(const CompiledPath& path)
+{
+    // Rough model: every step costs something per node in the frontier and
+    // multiplies the frontier by its expected fan-out. Recursive descent is
+    // priced as a walk over a subtree of a few dozen nodes.
+    double cost = 1;
+    double fanout = 1;
+    for (const JsonPathStep& step : path.steps) {
+        if (step.recursive) {
+            cost += fanout * 32;
+            fanout *= 32;
+        }
+        switch (step.kind) {
+            case JsonPathStep::Kind::Name:
+                cost += fanout;
+                break;
+            case JsonPathStep::Kind::Indices:
+                cost += fanout * step.indices.size();
+                fanout *= step.indices.size();
+                break;
+            case JsonPathStep::Kind::Slice:
+                cost += fanout * 4;
+                fanout *= 4;
+                break;
+            case JsonPathStep::Kind::Wildcard:
+                cost += fanout * 8;
+                fanout *= 8;
+                break;
+            case JsonPathStep::Kind::Union:
+                cost += fanout * step.unionEntries.size();
+                fanout *= step.unionEntries.size();
+                break;
+            case JsonPathStep::Kind::Filter:
+                cost += fanout * 8 * (step.filter ? step.filter->cost : 1);
+                fanout *= 4;
+                break;
+        }
+    }
+    return cost;
+}
+
+double
+FilterPlanner::comparisonCost(const std::string& op)
+{
+    // =~ compiles a std::regex on every evaluation.
+    if (op == "=~")
+        return 64;
+    return 1;
+}
+
+double
+FilterPlanner::comparisonSelectivity(const std::string& op)
+{
+    if (op == "==")
+        return 0.1;
+    if (op == "!=")
+        return 0.9;
+    if (op == "=~")
+        return 0.25;
+    return 0.33;
+}
+
+template <typename JsonType>
+struct JsonAccessor;
+
+template <>
+struct JsonAccessor<Json>
+{
+    using Pointer = Json*;
+    using ArrayType = std::vector<Json>;
+    using ObjectType = std::map<std::string, Json>;
+
+    static bool isArray(const Json& value) { return value.isArray(); }
+    static bool isObject(const Json& value) { return value.isObject(); }
+    static ArrayType& getArray(Json& value) { return value.getArray(); }
+    static ObjectType& getObject(Json& value) { return value.getObject(); }
+};
+
+template <>
+struct JsonAccessor<const Json>
+{
+    using Pointer = const Json*;
+    using ArrayType = const std::vector<Json>;
+    using ObjectType = const std::map<std::string, Json>;
+
+    static bool isArray(const Json& value) { return value.isArray(); }
+    static bool isObject(const Json& value) { return value.isObject(); }
+    static const ArrayType& getArray(const Json& value) { return value.getArray(); }
+    static const ObjectType& getObject(const Json& value) { return value.getObject(); }
+};
+
+static bool
+normalizeIndex(long long index, size_t size, size_t& out)
+{
+    long long normalized = index;
+    if (normalized < 0)
+        normalized += static_cast<long long>(size);
+    if (normalized < 0 || normalized >= static_cast<long long>(size))
+        return false;
+    out = static_cast<size_t>(normalized);
+    return true;
+}
+
+template <typename JsonType, typename Sink>
+static void
+applySlice(JsonType* node, const JsonPathSlice& slice, Sink& out)
+{
+    if (!node->isArray())
+        return;
+    auto& arr = JsonAccessor<JsonType>::getArray(*node);
     const long long size = static_cast<long long>(arr.size());
     if (size == 0)
         return;
@@ -2477,7 +3271,7 @@ applySlice(JsonType* node, const JsonPathSlice& slice, std::vector<JsonType*>& o
         // Calculate expected capacity and reserve
         if (start < end) {
             const size_t expectedCount = static_cast<size_t>((end - start + step - 1) / step);
-            out.reserve(out.size() + expectedCount);
+            reserveMore(out, expectedCount);
         }
         for (long long i = start; i < end; i += step)
             out.push_back(&arr[static_cast<size_t>(i)]);
@@ -2499,7 +3293,7 @@ applySlice(JsonType* node, const JsonPathSlice& slice, std::vector<JsonType*>& o
         // Calculate expected capacity for negative step
         if (start > end) {
             const size_t expectedCount = static_cast<size_t>((start - end - step - 1) / (-step));
-            out.reserve(out.size() + expectedCount);
+            reserveMore(out, expectedCount);
         }
         for (long long i = start; i > end; i += step) {
             if (i >= 0 && i < size)
@@ -2508,11 +3302,9 @@ applySlice(JsonType* node, const JsonPathSlice& slice, std::vector<JsonType*>& o
     }
 }
 
-template <typename JsonType>
+template <typename JsonType, typename Sink>
 static void
-applyUnionEntry(JsonType* node,
-                const JsonPathUnionEntry& entry,
-                std::vector<JsonType*>& out)
+applyUnionEntry(JsonType* node, const JsonPathUnionEntry& entry, Sink& out)
 {
     switch (entry.kind) {
         case JsonPathUnionKind::Name: {
@@ -2559,6 +3351,13 @@ evaluatePathInternal(JsonType* start,
                      const std::vector<JsonPathStep>& steps,
                      JsonType* documentRoot);
 
+template <typename JsonType, typename Sink>
+static void
+evaluatePathInto(JsonType* start,
+                 const std::vector<JsonPathStep>& steps,
+                 JsonType* documentRoot,
+                 Sink& out);
+
 static std::vector<Json*>
 evaluatePathMutable(Json& start,
                     const std::vector<JsonPathStep>& steps,
@@ -2581,23 +3380,248 @@ struct EvaluatedOperand
     }
 };
 
+// Folds matches into sum(), min(), max(), avg() or distinct() as the path
+// produces them, so no node list is built. A match that is an array
+// contributes its elements, which makes $.prices.sum() and
+// $.items[*].price.sum() both mean what they look like.
+class AggregateSink
+{
+  public:
+    explicit AggregateSink(JsonPathAggregate kind) : kind_(kind)
+    {
+    }
+
+    void reserve(size_t)
+    {
+    }
+
+    size_t size() const
+    {
+        return 0;
+    }
+
+    void push_back(const Json* node);
+    Json result() const;
+
+  private:
+    JsonPathAggregate kind_;
+    size_t count_ = 0;
+    bool integral_ = true;
+    long long longSum_ = 0;
+    double doubleSum_ = 0;
+    const Json* best_ = nullptr;
+    std::vector<Json> distinct_;
+    std::unordered_set<std::string> seen_;
+
+    void add(const Json& value);
+    void addSum(const Json& value, double& lane);
+    void sumArray(const std::vector<Json>& values);
+    bool better(const Json& value) const;
+    static std::string distinctKey(const Json& value);
+};
+
+void
+AggregateSink::push_back(const Json* node)
+{
+    if (!node->isArray()) {
+        add(*node);
+        return;
+    }
+    const std::vector<Json>& values = node->getArray();
+    if (kind_ == JsonPathAggregate::Sum || kind_ == JsonPathAggregate::Avg) {
+        sumArray(values);
+        return;
+    }
+    for (const Json& value : values)
+        add(value);
+}
+
+void
+AggregateSink::add(const Json& value)
+{
+    switch (kind_) {
+        case JsonPathAggregate::Sum:
+        case JsonPathAggregate::Avg:
+            addSum(value, doubleSum_);
+            break;
+        case JsonPathAggregate::Min:
+        case JsonPathAggregate::Max:
+            if (value.isNumber() && (!best_ || better(value)))
+                best_ = &value;
+            break;
+        case JsonPathAggregate::Distinct:
+            if (seen_.insert(distinctKey(value)).second)
+                distinct_.push_back(value);
+            break;
+        case JsonPathAggregate::None:
+            break;
+    }
+}
+
+inline void
+AggregateSink::addSum(const Json& value, double& lane)
+{
+    if (value.isLong()) {
+        long long x = value.getLong();
+        if (integral_ && ckd_add(&longSum_, longSum_, x))
+            integral_ = false;
+        lane += static_cast<double>(x);
+    } else if (value.isDouble() || value.isFloat()) {
+        integral_ = false;
+        lane += value.getNumber();
+    } else {
+        return;
+    }
+    ++count_;
+}
+
+void
+AggregateSink::sumArray(const std::vector<Json>& values)
+{
+    // Four independent lanes break the floating point dependency chain so
+    // several additions can be in flight at once. This is as close to a
+    // vectorized reduction as the tagged Json layout allows.
+    double lanes[4] = { 0, 0, 0, 0 };
+    const size_t n = values.size();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        if (i + 4 + kPrefetchDistance < n)
+            prefetch(&values[i + 4 + kPrefetchDistance]);
+        addSum(values[i + 0], lanes[0]);
+        addSum(values[i + 1], lanes[1]);
+        addSum(values[i + 2], lanes[2]);
+        addSum(values[i + 3], lanes[3]);
+    }
+    for (; i < n; ++i)
+        addSum(values[i], lanes[0]);
+    doubleSum_ += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+bool
+AggregateSink::better(const Json& value) const
+{
+    bool less;
+    if (value.isLong() && best_->isLong())
+        less = value.getLong() < best_->getLong();
+    else
+        less = value.getNumber() < best_->getNumber();
+    if (kind_ == JsonPathAggregate::Min)
+        return less;
+    if (value.isLong() && best_->isLong())
+        return best_->getLong() < value.getLong();
+    return best_->getNumber() < value.getNumber();
+}
+
+std::string
+AggregateSink::distinctKey(const Json& value)
+{
+    // Numbers compare by value like == does in filters, so 1 and 1.0
+    // collapse into one entry. A long only keeps a key of its own when
+    // no double holds it exactly.
+    if (value.isNumber()) {
+        double d = value.getNumber();
+        if (value.isLong()) {
+            long long x = value.getLong();
+            if (x > (1LL << 53) || x < -(1LL << 53))
+                if (d >= 9223372036854775808.0 || static_cast<long long>(d) != x)
+                    return "L" + value.toString();
+        }
+        if (d == 0)
+            d = 0;
+        std::string key(1 + sizeof(d), 'n');
+        memcpy(&key[1], &d, sizeof(d));
+        return key;
+    }
+    std::string key(1, static_cast<char>('A' + value.getType()));
+    key += value.toString();
+    return key;
+}
+
+Json
+AggregateSink::result() const
+{
+    switch (kind_) {
+        case JsonPathAggregate::Sum:
+            if (integral_)
+                return Json(longSum_);
+            return Json(doubleSum_);
+        case JsonPathAggregate::Avg:
+            if (!count_)
+                return Json(nullptr);
+            return Json(doubleSum_ / count_);
+        case JsonPathAggregate::Min:
+        case JsonPathAggregate::Max:
+            if (!best_)
+                return Json(nullptr);
+            return *best_;
+        case JsonPathAggregate::Distinct: {
+            Json out;
+            out.setArray();
+            out.getArray() = distinct_;
+            return out;
+        }
+        case JsonPathAggregate::None:
+            break;
+    }
+    return Json(nullptr);
+}
+
+// State shared by every candidate a filter step tests. Subtrees and
+// operands the planner marked invariant store their result here the first
+// time they run.
+struct FilterScope
+{
+    struct CachedOperand
+    {
+        bool ready = false;
+        EvaluatedOperand value;
+    };
+
+    FilterScope(const Json& root, const JsonPathStep& step)
+      : documentRoot(root)
+      , nodeResults(step.filterCacheSlots, -1)
+      , operandResults(step.filterOperandSlots)
+    {
+    }
+
+    const Json& documentRoot;
+    std::vector<signed char> nodeResults;
+    std::vector<CachedOperand> operandResults;
+    JsonPathProfiler::Step* profile = nullptr;
+};
+
 class FilterEvaluator
 {
   public:
     static bool evaluate(const std::shared_ptr<FilterNode>& node,
-                         const Json& documentRoot,
+                         FilterScope& scope,
                          const Json& context);
 
   private:
+    static bool evaluateNode(const FilterNode& node,
+                             FilterScope& scope,
+                             const Json& context);
+    static const EvaluatedOperand& resolveOperand(const FilterOperand& operand,
+                                                  FilterScope& scope,
+                                                  const Json& context,
+                                                  EvaluatedOperand& scratch);
     static EvaluatedOperand evaluateOperand(const FilterOperand& operand,
-                                            const Json& documentRoot,
+                                            FilterScope& scope,
                                             const Json& context);
     static std::vector<const Json*> evaluatePath(const CompiledPath& path,
-                                                 const Json& documentRoot,
+                                                 FilterScope& scope,
                                                  const Json& context);
     static Json evaluateFunction(const FilterOperand::FunctionCall& fn,
-                                 const Json& documentRoot,
+                                 FilterScope& scope,
                                  const Json& context);
+    static Json evaluateAggregate(const FilterOperand& operand,
+                                  JsonPathAggregate kind,
+                                  FilterScope& scope,
+                                  const Json& context);
+    static Json aggregatePath(const CompiledPath& path,
+                              JsonPathAggregate kind,
+                              FilterScope& scope,
+                              const Json& context);
     static bool compare(const std::string& op,
                         const EvaluatedOperand& lhs,
                         const EvaluatedOperand& rhs);
@@ -2624,36 +3648,72 @@ class FilterEvaluator
 
 bool
 FilterEvaluator::evaluate(const std::shared_ptr<FilterNode>& node,
-                          const Json& documentRoot,
+                          FilterScope& scope,
                           const Json& context)
 {
     if (!node)
         return false;
-    switch (node->kind) {
+    if (node->cacheSlot >= 0) {
+        signed char& cached = scope.nodeResults[node->cacheSlot];
+        if (cached < 0)
+            cached = evaluateNode(*node, scope, context);
+        return cached != 0;
+    }
+    return evaluateNode(*node, scope, context);
+}
+
+bool
+FilterEvaluator::evaluateNode(const FilterNode& node,
+                              FilterScope& scope,
+                              const Json& context)
+{
+    switch (node.kind) {
         case FilterNode::Kind::Or:
-            return evaluate(node->left, documentRoot, context) ||
-                   evaluate(node->right, documentRoot, context);
+            return evaluate(node.left, scope, context) ||
+                   evaluate(node.right, scope, context);
         case FilterNode::Kind::And:
-            return evaluate(node->left, documentRoot, context) &&
-                   evaluate(node->right, documentRoot, context);
+            return evaluate(node.left, scope, context) &&
+                   evaluate(node.right, scope, context);
         case FilterNode::Kind::Not:
-            return !evaluate(node->left, documentRoot, context);
+            return !evaluate(node.left, scope, context);
         case FilterNode::Kind::Comparison: {
-            EvaluatedOperand lhs = evaluateOperand(node->lhs, documentRoot, context);
-            EvaluatedOperand rhs = evaluateOperand(node->rhs, documentRoot, context);
-            return compare(node->comparisonOp, lhs, rhs);
+            EvaluatedOperand lhsScratch, rhsScratch;
+            const EvaluatedOperand& lhs =
+              resolveOperand(node.lhs, scope, context, lhsScratch);
+            const EvaluatedOperand& rhs =
+              resolveOperand(node.rhs, scope, context, rhsScratch);
+            return compare(node.comparisonOp, lhs, rhs);
         }
         case FilterNode::Kind::Exists: {
-            EvaluatedOperand lhs = evaluateOperand(node->existsOperand, documentRoot, context);
-            return truthy(lhs);
+            EvaluatedOperand scratch;
+            return truthy(
+              resolveOperand(node.existsOperand, scope, context, scratch));
         }
     }
     return false;
 }
 
+const EvaluatedOperand&
+FilterEvaluator::resolveOperand(const FilterOperand& operand,
+                                FilterScope& scope,
+                                const Json& context,
+                                EvaluatedOperand& scratch)
+{
+    if (operand.cacheSlot < 0) {
+        scratch = evaluateOperand(operand, scope, context);
+        return scratch;
+    }
+    FilterScope::CachedOperand& cached = scope.operandResults[operand.cacheSlot];
+    if (!cached.ready) {
+        cached.value = evaluateOperand(operand, scope, context);
+        cached.ready = true;
+    }
+    return cached.value;
+}
+
 EvaluatedOperand
 FilterEvaluator::evaluateOperand(const FilterOperand& operand,
-                                 const Json& documentRoot,
+                                 FilterScope& scope,
                                  const Json& context)
 {
     EvaluatedOperand result;
@@ -2662,12 +3722,17 @@ FilterEvaluator::evaluateOperand(const FilterOperand& operand,
             result.addOwned(operand.literal);
             break;
         case FilterOperand::Type::Path: {
-            auto matches = evaluatePath(operand.path, documentRoot, context);
+            if (operand.path.aggregate != JsonPathAggregate::None) {
+                result.addOwned(
+                  aggregatePath(operand.path, operand.path.aggregate, scope, context));
+                break;
+            }
+            auto matches = evaluatePath(operand.path, scope, context);
             result.nodes.insert(result.nodes.end(), matches.begin(), matches.end());
             break;
         }
         case FilterOperand::Type::Function: {
-            Json value = evaluateFunction(*operand.function, documentRoot, context);
+            Json value = evaluateFunction(*operand.function, scope, context);
             result.addOwned(std::move(value));
             break;
         }
@@ -2677,22 +3742,25 @@ FilterEvaluator::evaluateOperand(const FilterOperand& operand,
 
 std::vector<const Json*>
 FilterEvaluator::evaluatePath(const CompiledPath& path,
-                              const Json& documentRoot,
+                              FilterScope& scope,
                               const Json& context)
 {
     if (path.relative)
-        return evaluatePathConst(context, path.steps, documentRoot);
-    return evaluatePathConst(documentRoot, path.steps, documentRoot);
+        return evaluatePathConst(context, path.steps, scope.documentRoot);
+    return evaluatePathConst(scope.documentRoot, path.steps, scope.documentRoot);
 }
 
 Json
 FilterEvaluator::evaluateFunction(const FilterOperand::FunctionCall& fn,
-                                  const Json& documentRoot,
+                                  FilterScope& scope,
                                   const Json& context)
 {
     if (fn.args.size() != 1)
         throw std::runtime_error("Filter function expects exactly one argument");
-    EvaluatedOperand arg = evaluateOperand(fn.args[0], documentRoot, context);
+    if (fn.name == FilterOperand::FunctionCall::Name::Aggregate)
+        return evaluateAggregate(fn.args[0], fn.aggregate, scope, context);
+    EvaluatedOperand scratch;
+    const EvaluatedOperand& arg = resolveOperand(fn.args[0], scope, context, scratch);
     const Json* target = nullptr;
     if (!arg.nodes.empty())
         target = arg.nodes.front();
@@ -2712,6 +3780,37 @@ FilterEvaluator::evaluateFunction(const FilterOperand::FunctionCall& fn,
     }
 }
 
+Json
+FilterEvaluator::evaluateAggregate(const FilterOperand& operand,
+                                   JsonPathAggregate kind,
+                                   FilterScope& scope,
+                                   const Json& context)
+{
+    if (operand.type == FilterOperand::Type::Path && operand.cacheSlot < 0 &&
+        operand.path.aggregate == JsonPathAggregate::None)
+        return aggregatePath(operand.path, kind, scope, context);
+    AggregateSink sink(kind);
+    EvaluatedOperand scratch;
+    const EvaluatedOperand& arg = resolveOperand(operand, scope, context, scratch);
+    for (const Json* node : arg.nodes)
+        sink.push_back(node);
+    return sink.result();
+}
+
+// Streams the matches of path's steps into an aggregate of the given
+// kind, whatever aggregate the path itself names.
+Json
+FilterEvaluator::aggregatePath(const CompiledPath& path,
+                               JsonPathAggregate kind,
+                               FilterScope& scope,
+                               const Json& context)
+{
+    AggregateSink sink(kind);
+    const Json* start = path.relative ? &context : &scope.documentRoot;
+    evaluatePathInto(start, path.steps, &scope.documentRoot, sink);
+    return sink.result();
+}
+
 bool
 FilterEvaluator::compare(const std::string& op,
                          const EvaluatedOperand& lhs,
@@ -2962,45 +4061,129 @@ FilterEvaluator::computeLength(const Json& value)
     return 0;
 }
 
-
-
-template <typename JsonType>
-static std::vector<JsonType*>
-evaluatePathInternal(JsonType* start,
-                     const std::vector<JsonPathStep>& steps,
-                     JsonType* documentRoot)
+template <typename JsonType, typename Sink>
+static void
+applyStep(const JsonPathStep& step,
+          JsonType* node,
+          FilterScope& filterScope,
+          Sink& next)
 {
-    std::vector<JsonType*> current;
-    current.reserve(1);
-    current.push_back(start);
-    if (steps.empty())
-        return current;
-    std::vector<JsonType*> next;
-    next.reserve(4);
-    std::vector<JsonType*> baseBuffer;
-    baseBuffer.reserve(4);
-    std::vector<JsonType*> recursionStack;
-    recursionStack.reserve(16);
-
-    for (const JsonPathStep& step : steps) {
-        const std::vector<JsonType*>* base = &current;
-        if (step.recursive) {
-            baseBuffer.clear();
-            if (!current.empty()) {
-                baseBuffer.reserve(current.size() * 4);
-                for (JsonType* node : current)
-                    collectDescendants(node, baseBuffer, recursionStack);
+    switch (step.kind) {
+        case JsonPathStep::Kind::Name: {
+            if (!node->isObject())
+                break;
+            auto& obj = JsonAccessor<JsonType>::getObject(*node);
+            auto it = obj.find(step.name);
+            if (it != obj.end())
+                next.push_back(&it->second);
+            break;
+        }
+        case JsonPathStep::Kind::Wildcard: {
+            if (node->isArray()) {
+                auto& arr = JsonAccessor<JsonType>::getArray(*node);
+                const size_t arrSize = arr.size();
+                if (arrSize > 0) {
+                    reserveMore(next, arrSize);
+                    for (size_t i = 0; i < arrSize; ++i) {
+                        if (i + kPrefetchDistance < arrSize)
+                            prefetch(&arr[i + kPrefetchDistance]);
+                        next.push_back(&arr[i]);
+                    }
+                }
+            } else if (node->isObject()) {
+                auto& obj = JsonAccessor<JsonType>::getObject(*node);
+                const size_t objSize = obj.size();
+                if (objSize > 0) {
+                    reserveMore(next, objSize);
+                    for (auto it = obj.begin(); it != obj.end(); ++it)
+                        next.push_back(&it->second);
+                }
             }
-            base = &baseBuffer;
+            break;
         }
-
-        next.clear();
-        if (!base->empty()) {
-            size_t estimatedCapacity = base->size();
-            switch (step.kind) {
-                case JsonPathStep::Kind::Wildcard:
-                    estimatedCapacity *= 8;
-                    break;
+        case JsonPathStep::Kind::Indices: {
+            if (!node->isArray())
+                break;
+            auto& arr = JsonAccessor<JsonType>::getArray(*node);
+            const size_t indicesCount = step.indices.size();
+            if (indicesCount > 0) {
+                reserveMore(next, indicesCount);
+                for (long long raw : step.indices) {
+                    size_t idx;
+                    if (normalizeIndex(raw, arr.size(), idx))
+                        next.push_back(&arr[idx]);
+                }
+            }
+            break;
+        }
+        case JsonPathStep::Kind::Slice:
+            applySlice(node, step.slice, next);
+            break;
+        case JsonPathStep::Kind::Union: {
+            for (const auto& entry : step.unionEntries)
+                applyUnionEntry(node, entry, next);
+            break;
+        }
+        case JsonPathStep::Kind::Filter: {
+            if (!step.filter)
+                break;
+            if (node->isArray()) {
+                auto& arr = JsonAccessor<JsonType>::getArray(*node);
+                const size_t arrSize = arr.size();
+                if (filterScope.profile)
+                    filterScope.profile->filterEvaluations += arrSize;
+                if (arrSize > 0) {
+                    reserveMore(next, arrSize / 2);
+                    for (size_t i = 0; i < arrSize; ++i) {
+                        if (i + kPrefetchDistance < arrSize)
+                            prefetch(&arr[i + kPrefetchDistance]);
+                        JsonType* candidate = &arr[i];
+                        if (FilterEvaluator::evaluate(step.filter,
+                                                      filterScope,
+                                                      static_cast<const Json&>(arr[i])))
+                            next.push_back(candidate);
+                    }
+                }
+            } else if (node->isObject()) {
+                auto& obj = JsonAccessor<JsonType>::getObject(*node);
+                const size_t objSize = obj.size();
+                if (filterScope.profile)
+                    filterScope.profile->filterEvaluations += objSize;
+                if (objSize > 0) {
+                    reserveMore(next, objSize / 2);
+                    for (auto it = obj.begin(); it != obj.end(); ++it) {
+                        if (FilterEvaluator::evaluate(step.filter,
+                                                      filterScope,
+                                                      static_cast<const Json&>(it->second)))
+                            next.push_back(&it->second);
+                    }
+                }
+            }
+            break;
+        }
+    }
+}
+
+template <typename JsonType, typename Sink>
+static void
+applyStepToFrontier(const JsonPathStep& step,
+                    const std::vector<JsonType*>& frontier,
+                    JsonType* documentRoot,
+                    std::vector<JsonType*>& stack,
+                    Sink& out,
+                    JsonPathProfiler::Step* profile = nullptr)
+{
+    FilterScope filterScope(static_cast<const Json&>(*documentRoot), step);
+    filterScope.profile = profile;
+    if (!step.recursive) {
+        if (profile)
+            profile->nodesVisited += frontier.size();
+        if (!frontier.empty()) {
+            size_t estimatedCapacity = frontier.size();
+            switch (step.kind) {
+                case JsonPathStep::Kind::Wildcard:
+                    estimatedCapacity *= 8;
+                    break;
                 case JsonPathStep::Kind::Union:
                     estimatedCapacity *= step.unionEntries.size();
                     break;
@@ -3010,105 +4193,120 @@ evaluatePathInternal(JsonType* start,
                 default:
                     break;
             }
-            next.reserve(estimatedCapacity);
+            reserveMore(out, estimatedCapacity);
         }
-
-        for (JsonType* node : *base) {
-            switch (step.kind) {
-                case JsonPathStep::Kind::Name: {
-                    if (!node->isObject())
-                        break;
-                    auto& obj = JsonAccessor<JsonType>::getObject(*node);
-                    auto it = obj.find(step.name);
-                    if (it != obj.end())
-                        next.push_back(&it->second);
-                    break;
-                }
-                case JsonPathStep::Kind::Wildcard: {
-                    if (node->isArray()) {
-                        auto& arr = JsonAccessor<JsonType>::getArray(*node);
-                        const size_t arrSize = arr.size();
-                        if (arrSize > 0) {
-                            next.reserve(next.size() + arrSize);
-                            for (size_t i = 0; i < arrSize; ++i) {
-                                if (i + kPrefetchDistance < arrSize)
-                                    prefetch(&arr[i + kPrefetchDistance]);
-                                next.push_back(&arr[i]);
-                            }
-                        }
-                    } else if (node->isObject()) {
-                        auto& obj = JsonAccessor<JsonType>::getObject(*node);
-                        const size_t objSize = obj.size();
-                        if (objSize > 0) {
-                            next.reserve(next.size() + objSize);
-                            for (auto it = obj.begin(); it != obj.end(); ++it)
-                                next.push_back(&it->second);
-                        }
-                    }
-                    break;
-                }
-                case JsonPathStep::Kind::Indices: {
-                    if (!node->isArray())
-                        break;
-                    auto& arr = JsonAccessor<JsonType>::getArray(*node);
-                    const size_t indicesCount = step.indices.size();
-                    if (indicesCount > 0) {
-                        next.reserve(next.size() + indicesCount);
-                        for (long long raw : step.indices) {
-                            size_t idx;
-                            if (normalizeIndex(raw, arr.size(), idx))
-                                next.push_back(&arr[idx]);
-                        }
-                    }
-                    break;
-                }
-                case JsonPathStep::Kind::Slice:
-                    applySlice(node, step.slice, next);
-                    break;
-                case JsonPathStep::Kind::Union: {
-                    for (const auto& entry : step.unionEntries)
-                        applyUnionEntry(node, entry, next);
-                    break;
-                }
-                case JsonPathStep::Kind::Filter: {
-                    if (!step.filter)
-                        break;
-                    const Json& docRef = static_cast<const Json&>(*documentRoot);
-                    if (node->isArray()) {
-                        auto& arr = JsonAccessor<JsonType>::getArray(*node);
-                        const size_t arrSize = arr.size();
-                        if (arrSize > 0) {
-                            next.reserve(next.size() + arrSize / 2);
-                            for (size_t i = 0; i < arrSize; ++i) {
-                                if (i + kPrefetchDistance < arrSize)
-                                    prefetch(&arr[i + kPrefetchDistance]);
-                                JsonType* candidate = &arr[i];
-                                if (FilterEvaluator::evaluate(step.filter,
-                                                              docRef,
-                                                              static_cast<const Json&>(arr[i])))
-                                    next.push_back(candidate);
-                            }
-                        }
-                    } else if (node->isObject()) {
-                        auto& obj = JsonAccessor<JsonType>::getObject(*node);
-                        const size_t objSize = obj.size();
-                        if (objSize > 0) {
-                            next.reserve(next.size() + objSize / 2);
-                            for (auto it = obj.begin(); it != obj.end(); ++it) {
-                                if (FilterEvaluator::evaluate(step.filter,
-                                                              docRef,
-                                                              static_cast<const Json&>(it->second)))
-                                    next.push_back(&it->second);
-                            }
-                        }
-                    }
-                    break;
-                }
+        for (JsonType* node : frontier)
+            applyStep(step, node, filterScope, out);
+        return;
+    }
+    // Recursive descent applies the step to each node of the subtree in
+    // document order as it is reached, so the descendants are never
+    // gathered into an intermediate list.
+    for (JsonType* root : frontier) {
+        stack.clear();
+        stack.push_back(root);
+        while (!stack.empty()) {
+            JsonType* current = stack.back();
+            stack.pop_back();
+            if (profile)
+                ++profile->nodesVisited;
+            applyStep(step, current, filterScope, out);
+            if (current->isArray()) {
+                auto& arr = JsonAccessor<JsonType>::getArray(*current);
+                for (size_t i = arr.size(); i-- > 0;)
+                    stack.push_back(&arr[i]);
+            } else if (current->isObject()) {
+                auto& obj = JsonAccessor<JsonType>::getObject(*current);
+                for (auto it = obj.rbegin(); it != obj.rend(); ++it)
+                    stack.push_back(&it->second);
             }
         }
+    }
+}
+
+template <typename JsonType, typename Sink>
+static void
+evaluatePathInto(JsonType* start,
+                 const std::vector<JsonPathStep>& steps,
+                 JsonType* documentRoot,
+                 Sink& out)
+{
+    if (steps.empty()) {
+        out.push_back(start);
+        return;
+    }
+    std::vector<JsonType*> current(1, start);
+    std::vector<JsonType*> next;
+    std::vector<JsonType*> stack;
+    const size_t last = steps.size() - 1;
+    for (size_t i = 0; i < last; ++i) {
+        next.clear();
+        applyStepToFrontier(steps[i], current, documentRoot, stack, next);
         current.swap(next);
+        if (current.empty())
+            return;
     }
-    return current;
+    // The final step feeds the caller's sink directly, which lets
+    // aggregates consume matches without a result vector.
+    applyStepToFrontier(steps[last], current, documentRoot, stack, out);
+}
+
+// Same as evaluatePathInto() but times every step and counts the work it
+// does. Each step materializes its matches so they can be counted.
+template <typename JsonType, typename Sink>
+static void
+evaluatePathProfiled(JsonType* start,
+                     const std::vector<JsonPathStep>& steps,
+                     JsonType* documentRoot,
+                     Sink& out,
+                     JsonPathProfiler::Query& query)
+{
+    query.steps.resize(steps.size());
+    for (size_t i = 0; i < steps.size(); ++i)
+        query.steps[i].selector = steps[i].text;
+    std::vector<JsonType*> current(1, start);
+    std::vector<JsonType*> next;
+    std::vector<JsonType*> stack;
+    for (size_t i = 0; i < steps.size() && !current.empty(); ++i) {
+        JsonPathProfiler::Step& profile = query.steps[i];
+        profile.frontier = current.size();
+        profile.maxFrontier = current.size();
+        const uint64_t started = profileNanos();
+        next.clear();
+        applyStepToFrontier(steps[i], current, documentRoot, stack, next, &profile);
+        profile.nanos = profileNanos() - started;
+        profile.matches = next.size();
+        current.swap(next);
+    }
+    query.matches = current.size();
+    reserveMore(out, current.size());
+    for (JsonType* node : current)
+        out.push_back(node);
+}
+
+template <typename JsonType, typename Sink>
+static void
+evaluateQueryInto(JsonType* start,
+                  const std::vector<JsonPathStep>& steps,
+                  JsonType* documentRoot,
+                  Sink& out,
+                  ProfiledQuery& profile)
+{
+    if (JsonPathProfiler::Query* query = profile.query())
+        evaluatePathProfiled(start, steps, documentRoot, out, *query);
+    else
+        evaluatePathInto(start, steps, documentRoot, out);
+}
+
+template <typename JsonType>
+static std::vector<JsonType*>
+evaluatePathInternal(JsonType* start,
+                     const std::vector<JsonPathStep>& steps,
+                     JsonType* documentRoot)
+{
+    std::vector<JsonType*> result;
+    evaluatePathInto(start, steps, documentRoot, result);
+    return result;
 }
 
 static std::vector<Json*>
@@ -3132,19 +4330,50 @@ evaluatePathConst(const Json& start,
 std::vector<Json*>
 Json::jsonpath(const std::string& expression)
 {
+    detail::ProbedQuery probe(detail::ProbedQuery::Query, expression);
+    detail::ProfiledQuery profile(expression);
     const detail::CompiledPath& compiled = detail::getCompiledPathCached(expression);
     if (compiled.relative)
         throw std::runtime_error("JSONPath expression must start with '$'");
-    return detail::evaluatePathInternal<Json>(this, compiled.steps, this);
+    if (compiled.aggregate != detail::JsonPathAggregate::None)
+        throw std::runtime_error("JSONPath aggregate functions require aggregateJsonpath()");
+    std::vector<Json*> matches;
+    detail::evaluateQueryInto(this, compiled.steps, this, matches, profile);
+    profile.finish();
+    probe.done(matches.size());
+    return matches;
 }
 
 std::vector<const Json*>
 Json::jsonpath(const std::string& expression) const
 {
+    detail::ProbedQuery probe(detail::ProbedQuery::Query, expression);
+    detail::ProfiledQuery profile(expression);
+    const detail::CompiledPath& compiled = detail::getCompiledPathCached(expression);
+    if (compiled.relative)
+        throw std::runtime_error("JSONPath expression must start with '$'");
+    if (compiled.aggregate != detail::JsonPathAggregate::None)
+        throw std::runtime_error("JSONPath aggregate functions require aggregateJsonpath()");
+    std::vector<const Json*> matches;
+    detail::evaluateQueryInto(this, compiled.steps, this, matches, profile);
+    profile.finish();
+    probe.done(matches.size());
+    return matches;
+}
+
+Json
+Json::aggregateJsonpath(const std::string& expression) const
+{
+    detail::ProfiledQuery profile(expression);
     const detail::CompiledPath& compiled = detail::getCompiledPathCached(expression);
     if (compiled.relative)
         throw std::runtime_error("JSONPath expression must start with '$'");
-    return detail::evaluatePathInternal<const Json>(this, compiled.steps, this);
+    if (compiled.aggregate == detail::JsonPathAggregate::None)
+        throw std::runtime_error("JSONPath expression must end with an aggregate function");
+    detail::AggregateSink sink(compiled.aggregate);
+    detail::evaluateQueryInto(this, compiled.steps, this, sink, profile);
+    profile.finish();
+    return sink.result();
 }
 
 namespace detail {
@@ -3184,8 +4413,8 @@ collectDescendantsWithParent(JsonPathNodeWithParent item,
             auto& arr = node->getArray();
             const size_t arrSize = arr.size();
             if (arrSize > 0) {
-                out.reserve(out.size() + arrSize);
-                stack.reserve(stack.size() + arrSize);
+                reserveMore(out, arrSize);
+                reserveMore(stack, arrSize);
                 for (size_t i = arrSize; i-- > 0;) {
                     JsonPathNodeWithParent child(&arr[i]);
                     child.parent = node;
@@ -3198,8 +4427,8 @@ collectDescendantsWithParent(JsonPathNodeWithParent item,
             auto& obj = node->getObject();
             const size_t objSize = obj.size();
             if (objSize > 0) {
-                out.reserve(out.size() + objSize);
-                stack.reserve(stack.size() + objSize);
+                reserveMore(out, objSize);
+                reserveMore(stack, objSize);
                 for (auto it = obj.rbegin(); it != obj.rend(); ++it) {
                     JsonPathNodeWithParent child(&it->second);
                     child.parent = node;
@@ -3215,7 +4444,8 @@ collectDescendantsWithParent(JsonPathNodeWithParent item,
 static std::vector<JsonPathNodeWithParent>
 evaluatePathWithParentInternal(Json* start,
                                 const std::vector<JsonPathStep>& steps,
-                                Json* documentRoot)
+                                Json* documentRoot,
+                                JsonPathProfiler::Query* query = nullptr)
 {
     std::vector<JsonPathNodeWithParent> current;
     current.reserve(1);
@@ -3229,8 +4459,17 @@ evaluatePathWithParentInternal(Json* start,
     baseBuffer.reserve(4);
     std::vector<JsonPathNodeWithParent> recursionStack;
     recursionStack.reserve(16);
+    if (query) {
+        query->steps.resize(steps.size());
+        for (size_t i = 0; i < steps.size(); ++i)
+            query->steps[i].selector = steps[i].text;
+    }
 
-    for (const JsonPathStep& step : steps) {
+    for (size_t stepIndex = 0; stepIndex < steps.size(); ++stepIndex) {
+        const JsonPathStep& step = steps[stepIndex];
+        JsonPathProfiler::Step* profile = query ? &query->steps[stepIndex] : nullptr;
+        const uint64_t started = profile ? profileNanos() : 0;
+        FilterScope filterScope(*documentRoot, step);
         const std::vector<JsonPathNodeWithParent>* base = &current;
         if (step.recursive) {
             baseBuffer.clear();
@@ -3241,6 +4480,11 @@ evaluatePathWithParentInternal(Json* start,
             }
             base = &baseBuffer;
         }
+        if (profile) {
+            profile->frontier = current.size();
+            profile->maxFrontier = current.size();
+            profile->nodesVisited = base->size();
+        }
 
         next.clear();
         if (!base->empty()) {
@@ -3283,7 +4527,7 @@ evaluatePathWithParentInternal(Json* start,
                         auto& arr = node->getArray();
                         const size_t arrSize = arr.size();
                         if (arrSize > 0) {
-                            next.reserve(next.size() + arrSize);
+                            reserveMore(next, arrSize);
                             for (size_t i = 0; i < arrSize; ++i) {
                                 if (i + kPrefetchDistance < arrSize)
                                     prefetch(&arr[i + kPrefetchDistance]);
@@ -3298,7 +4542,7 @@ evaluatePathWithParentInternal(Json* start,
                         auto& obj = node->getObject();
                         const size_t objSize = obj.size();
                         if (objSize > 0) {
-                            next.reserve(next.size() + objSize);
+                            reserveMore(next, objSize);
                             for (auto it = obj.begin(); it != obj.end(); ++it) {
                                 JsonPathNodeWithParent child(&it->second);
                                 child.parent = node;
@@ -3316,7 +4560,7 @@ evaluatePathWithParentInternal(Json* start,
                     auto& arr = node->getArray();
                     const size_t indicesCount = step.indices.size();
                     if (indicesCount > 0) {
-                        next.reserve(next.size() + indicesCount);
+                        reserveMore(next, indicesCount);
                         for (long long raw : step.indices) {
                             size_t idx;
                             if (normalizeIndex(raw, arr.size(), idx)) {
@@ -3351,7 +4595,7 @@ evaluatePathWithParentInternal(Json* start,
                         end = std::max(0LL, std::min(end, arrSize));
                         if (start < end) {
                             const size_t expectedCount = static_cast<size_t>((end - start + sliceStep - 1) / sliceStep);
-                            next.reserve(next.size() + expectedCount);
+                            reserveMore(next, expectedCount);
                         }
                         for (long long i = start; i < end; i += sliceStep) {
                             JsonPathNodeWithParent child(&arr[static_cast<size_t>(i)]);
@@ -3377,7 +4621,7 @@ evaluatePathWithParentInternal(Json* start,
                             end = -1;
                         if (start > end) {
                             const size_t expectedCount = static_cast<size_t>((start - end - sliceStep - 1) / (-sliceStep));
-                            next.reserve(next.size() + expectedCount);
+                            reserveMore(next, expectedCount);
                         }
                         for (long long i = start; i > end; i += sliceStep) {
                             if (i >= 0 && i < arrSize) {
@@ -3429,7 +4673,7 @@ evaluatePathWithParentInternal(Json* start,
                                     auto& arr = node->getArray();
                                     const size_t arrSize = arr.size();
                                     if (arrSize > 0) {
-                                        next.reserve(next.size() + arrSize);
+                                        reserveMore(next, arrSize);
                                         for (size_t i = 0; i < arrSize; ++i) {
                                             JsonPathNodeWithParent child(&arr[i]);
                                             child.parent = node;
@@ -3442,7 +4686,7 @@ evaluatePathWithParentInternal(Json* start,
                                     auto& obj = node->getObject();
                                     const size_t objSize = obj.size();
                                     if (objSize > 0) {
-                                        next.reserve(next.size() + objSize);
+                                        reserveMore(next, objSize);
                                         for (auto it = obj.begin(); it != obj.end(); ++it) {
                                             JsonPathNodeWithParent child(&it->second);
                                             child.parent = node;
@@ -3460,17 +4704,18 @@ evaluatePathWithParentInternal(Json* start,
                 case JsonPathStep::Kind::Filter: {
                     if (!step.filter)
                         break;
-                    const Json& docRef = static_cast<const Json&>(*documentRoot);
                     if (node->isArray()) {
                         auto& arr = node->getArray();
                         const size_t arrSize = arr.size();
+                        if (profile)
+                            profile->filterEvaluations += arrSize;
                         if (arrSize > 0) {
-                            next.reserve(next.size() + arrSize / 2);
+                            reserveMore(next, arrSize / 2);
                             for (size_t i = 0; i < arrSize; ++i) {
                                 if (i + kPrefetchDistance < arrSize)
                                     prefetch(&arr[i + kPrefetchDistance]);
                                 if (FilterEvaluator::evaluate(step.filter,
-                                                              docRef,
+                                                              filterScope,
                                                               static_cast<const Json&>(arr[i]))) {
                                     JsonPathNodeWithParent child(&arr[i]);
                                     child.parent = node;
@@ -3483,11 +4728,13 @@ evaluatePathWithParentInternal(Json* start,
                     } else if (node->isObject()) {
                         auto& obj = node->getObject();
                         const size_t objSize = obj.size();
+                        if (profile)
+                            profile->filterEvaluations += objSize;
                         if (objSize > 0) {
-                            next.reserve(next.size() + objSize / 2);
+                            reserveMore(next, objSize / 2);
                             for (auto it = obj.begin(); it != obj.end(); ++it) {
                                 if (FilterEvaluator::evaluate(step.filter,
-                                                              docRef,
+                                                              filterScope,
                                                               static_cast<const Json&>(it->second))) {
                                     JsonPathNodeWithParent child(&it->second);
                                     child.parent = node;
@@ -3503,7 +4750,13 @@ evaluatePathWithParentInternal(Json* start,
             }
         }
         current.swap(next);
+        if (profile) {
+            profile->matches = current.size();
+            profile->nanos = profileNanos() - started;
+        }
     }
+    if (query)
+        query->matches = current.size();
     return current;
 }
 
@@ -3512,22 +4765,31 @@ evaluatePathWithParentInternal(Json* start,
 size_t
 Json::updateJsonpath(const std::string& expression, const Json& value)
 {
+    detail::ProbedQuery probe(detail::ProbedQuery::Update, expression);
+    detail::ProfiledQuery profile(expression);
     auto matches = jsonpath(expression);
     size_t count = 0;
     for (Json* node : matches) {
         *node = value;
         ++count;
     }
+    profile.finish();
+    probe.done(count);
     return count;
 }
 
 size_t
 Json::updateJsonpath(const std::string& expression, Json&& value)
 {
+    detail::ProbedQuery probe(detail::ProbedQuery::Update, expression);
+    detail::ProfiledQuery profile(expression);
     auto matches = jsonpath(expression);
     size_t count = 0;
-    if (matches.empty())
+    if (matches.empty()) {
+        profile.finish();
+        probe.done(count);
         return 0;
+    }
     
     // For move assignment, we need to create a copy for each match except the first
     Json firstValue = std::move(value);
@@ -3539,17 +4801,23 @@ Json::updateJsonpath(const std::string& expression, Json&& value)
         *matches[i] = *matches[0];
         ++count;
     }
+    profile.finish();
+    probe.done(count);
     return count;
 }
 
 size_t
 Json::deleteJsonpath(const std::string& expression)
 {
+    detail::ProbedQuery probe(detail::ProbedQuery::Delete, expression);
+    detail::ProfiledQuery profile(expression);
     const detail::CompiledPath& compiled = detail::getCompiledPathCached(expression);
     if (compiled.relative)
         throw std::runtime_error("JSONPath expression must start with '$'");
+    if (compiled.aggregate != detail::JsonPathAggregate::None)
+        throw std::runtime_error("JSONPath aggregate functions require aggregateJsonpath()");
     
-    auto matches = detail::evaluatePathWithParentInternal(this, compiled.steps, this);
+    auto matches = detail::evaluatePathWithParentInternal(this, compiled.steps, this, profile.query());
     
     // Sort by reverse order to avoid index shifting issues when deleting from arrays
     // Sort by array index descending, object keys can be in any order
@@ -3587,9 +4855,1988 @@ Json::deleteJsonpath(const std::string& expression)
             }
         }
     }
+    profile.finish();
+    probe.done(count);
     return count;
 }
 
+JsonPathProfiler*
+setJsonPathProfiler(JsonPathProfiler* profiler)
+{
+    JsonPathProfiler* previous = detail::tProfiler;
+    detail::tProfiler = profiler;
+    return previous;
+}
+
+Json
+JsonPathProfiler::toJson() const
+{
+    Json json;
+    json.setObject();
+    for (const auto& expression : expressions) {
+        const Expression& entry = expression.second;
+        Json& out = json[expression.first];
+        out["evaluations"] = static_cast<long long>(entry.evaluations);
+        out["compiles"] = static_cast<long long>(entry.compiles);
+        out["slowQueries"] = static_cast<long long>(entry.slowQueries);
+        out["nanos"] = static_cast<long long>(entry.nanos);
+        out["maxNanos"] = static_cast<long long>(entry.maxNanos);
+        out["compileNanos"] = static_cast<long long>(entry.compileNanos);
+        out["matches"] = static_cast<long long>(entry.matches);
+        Json& steps = out["steps"];
+        steps.setArray();
+        for (const Step& step : entry.steps) {
+            Json item;
+            item["selector"] = step.selector;
+            item["frontier"] = static_cast<long long>(step.frontier);
+            item["maxFrontier"] = static_cast<long long>(step.maxFrontier);
+            item["nodesVisited"] = static_cast<long long>(step.nodesVisited);
+            item["filterEvaluations"] = static_cast<long long>(step.filterEvaluations);
+            item["matches"] = static_cast<long long>(step.matches);
+            item["nanos"] = static_cast<long long>(step.nanos);
+            steps.getArray().push_back(std::move(item));
+        }
+    }
+    return json;
+}
+
+
+static const char* const kTypeNames[] = { "null",   "bool",   "long",  "float",
+                                          "double", "string", "array", "object" };
+
+static const char*
+typeName(const Json& value)
+{
+    return kTypeNames[value.getType()];
+}
+
+namespace detail {
+
+// Appends rows to one Column, settling and widening its type as values
+// arrive and keeping the string dictionary's reverse index.
+class ColumnBuilder
+{
+  public:
+    explicit ColumnBuilder(Column& column) : column_(&column)
+    {
+    }
+
+    void append(const Json& value);
+    void appendNull();
+
+  private:
+    Column* column_;
+    std::unordered_map<std::string, uint32_t> dictionary_;
+
+    void grow(bool valid);
+    void settle(Column::Type type);
+    uint32_t encode(const std::string& value);
+    [[noreturn]] void mismatch(const Json& value) const;
+};
+
+void
+ColumnBuilder::grow(bool valid)
+{
+    Column& c = *column_;
+    size_t row = c.length++;
+    if (!(row & 7)) {
+        c.validity.push_back(0);
+        if (c.type == Column::Bool)
+            c.bools.push_back(0);
+    }
+    if (valid)
+        c.validity[row >> 3] |= 1 << (row & 7);
+    else
+        ++c.nulls;
+}
+
+void
+ColumnBuilder::settle(Column::Type type)
+{
+    // Earlier rows were all null, so their slots only need to exist.
+    Column& c = *column_;
+    c.type = type;
+    switch (type) {
+        case Column::Bool:
+            c.bools.resize((c.length + 7) >> 3);
+            break;
+        case Column::Long:
+            c.longs.resize(c.length);
+            break;
+        case Column::Double:
+            c.doubles.resize(c.length);
+            break;
+        case Column::String:
+            c.codes.resize(c.length);
+            break;
+        case Column::Null:
+            break;
+    }
+}
+
+uint32_t
+ColumnBuilder::encode(const std::string& value)
+{
+    auto it = dictionary_.find(value);
+    if (it != dictionary_.end())
+        return it->second;
+    if (column_->dictionary.size() > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("column dictionary overflow: " + column_->name);
+    uint32_t code = static_cast<uint32_t>(column_->dictionary.size());
+    column_->dictionary.push_back(value);
+    dictionary_.emplace(value, code);
+    return code;
+}
+
+void
+ColumnBuilder::mismatch(const Json& value) const
+{
+    throw std::runtime_error("column '" + column_->name + "' cannot hold " +
+                             typeName(value) + " value");
+}
+
+void
+ColumnBuilder::append(const Json& value)
+{
+    Column& c = *column_;
+    switch (value.getType()) {
+        case Json::Null:
+            appendNull();
+            return;
+        case Json::Bool:
+            if (c.type == Column::Null)
+                settle(Column::Bool);
+            if (c.type != Column::Bool)
+                mismatch(value);
+            grow(true);
+            if (value.getBool())
+                c.bools[(c.length - 1) >> 3] |= 1 << ((c.length - 1) & 7);
+            return;
+        case Json::Long:
+            if (c.type == Column::Null)
+                settle(Column::Long);
+            if (c.type == Column::Long) {
+                c.longs.push_back(value.getLong());
+            } else if (c.type == Column::Double) {
+                c.doubles.push_back(value.getNumber());
+            } else {
+                mismatch(value);
+            }
+            grow(true);
+            return;
+        case Json::Float:
+        case Json::Double:
+            if (c.type == Column::Null)
+                settle(Column::Double);
+            if (c.type == Column::Long) {
+                c.doubles.assign(c.longs.begin(), c.longs.end());
+                std::vector<long long>().swap(c.longs);
+                c.type = Column::Double;
+            }
+            if (c.type != Column::Double)
+                mismatch(value);
+            c.doubles.push_back(value.getNumber());
+            grow(true);
+            return;
+        case Json::String:
+            if (c.type == Column::Null)
+                settle(Column::String);
+            if (c.type != Column::String)
+                mismatch(value);
+            c.codes.push_back(encode(value.getString()));
+            grow(true);
+            return;
+        default:
+            mismatch(value);
+    }
+}
+
+void
+ColumnBuilder::appendNull()
+{
+    Column& c = *column_;
+    switch (c.type) {
+        case Column::Long:
+            c.longs.push_back(0);
+            break;
+        case Column::Double:
+            c.doubles.push_back(0);
+            break;
+        case Column::String:
+            c.codes.push_back(0);
+            break;
+        default:
+            break;
+    }
+    grow(false);
+}
+
+// Streams records from NDJSON or a top-level array straight into column
+// builders. Keys and projected values go through the ordinary parser and
+// other values are skipped, so records are never assembled and no
+// per-record map is created. NDJSON records must each start on a new
+// line.
+class ColumnParser
+{
+  public:
+    ColumnParser(const std::vector<std::string>& fields, Columns& out);
+    Json::Status parse(const std::string& text);
+
+  private:
+    Columns& out_;
+    std::vector<ColumnBuilder> builders_;
+    std::vector<unsigned char> seen_;
+    Json key_;
+    Json value_;
+
+    int findField(const std::string& key) const;
+    Json::Status parseRecord(const char*& p, const char* e);
+    static void skipSpace(const char*& p, const char* e);
+};
+
+static void
+initColumns(const std::vector<std::string>& fields,
+            Columns& out,
+            std::vector<ColumnBuilder>& builders)
+{
+    out.rows = 0;
+    out.columns.clear();
+    out.columns.resize(fields.size());
+    builders.reserve(fields.size());
+    for (size_t i = 0; i < fields.size(); ++i) {
+        out.columns[i].name = fields[i];
+        builders.emplace_back(out.columns[i]);
+    }
+}
+
+ColumnParser::ColumnParser(const std::vector<std::string>& fields, Columns& out)
+  : out_(out), seen_(fields.size())
+{
+    initColumns(fields, out, builders_);
+}
+
+void
+ColumnParser::skipSpace(const char*& p, const char* e)
+{
+    while (p < e && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+        ++p;
+}
+
+int
+ColumnParser::findField(const std::string& key) const
+{
+    // Projections name a handful of fields, so a scan that rejects on
+    // length first beats hashing every key.
+    for (size_t i = 0; i < out_.columns.size(); ++i) {
+        const std::string& name = out_.columns[i].name;
+        if (name.size() == key.size() &&
+            !memcmp(name.data(), key.data(), key.size()))
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+Json::Status
+ColumnParser::parseRecord(const char*& p, const char* e)
+{
+    std::fill(seen_.begin(), seen_.end(), 0);
+    for (int context = KEY | OBJECT;; context = KEY | COMMA | OBJECT) {
+        key_.clear();
+        Json::Status status = Json::parse(key_, p, e, context, DEPTH - 1);
+        if (status == Json::absent_value)
+            break;
+        if (status != Json::success)
+            return status;
+        if (!key_.isString())
+            return Json::object_key_must_be_string;
+        // Only projected values are built; the rest are stepped over.
+        int field = findField(key_.string_value);
+        bool wanted = field >= 0 && !seen_[field];
+        if (wanted) {
+            value_.clear();
+            status = Json::parse(value_, p, e, COLON, DEPTH - 1);
+        } else {
+            status = Json::skip(p, e, COLON, DEPTH - 1);
+        }
+        if (status == Json::absent_value)
+            return Json::object_missing_value;
+        if (status != Json::success)
+            return status;
+        if (wanted) {
+            seen_[field] = 1;
+            builders_[field].append(value_);
+        }
+    }
+    for (size_t i = 0; i < builders_.size(); ++i)
+        if (!seen_[i])
+            builders_[i].appendNull();
+    ++out_.rows;
+    return Json::success;
+}
+
+Json::Status
+ColumnParser::parse(const std::string& text)
+{
+    const char* p = text.data();
+    const char* e = p + text.size();
+    skipSpace(p, e);
+    if (p < e && *p == '[') {
+        ++p;
+        for (bool first = true;; first = false) {
+            skipSpace(p, e);
+            if (p == e)
+                return Json::unexpected_eof;
+            if (*p == ']') {
+                if (!first)
+                    return Json::unexpected_end_of_array;
+                ++p;
+                break;
+            }
+            if (*p != '{')
+                return Json::record_must_be_object;
+            ++p;
+            Json::Status status = parseRecord(p, e);
+            if (status != Json::success)
+                return status;
+            skipSpace(p, e);
+            if (p == e)
+                return Json::unexpected_eof;
+            if (*p == ']') {
+                ++p;
+                break;
+            }
+            if (*p++ != ',')
+                return Json::missing_comma;
+        }
+        skipSpace(p, e);
+        if (p < e)
+            return Json::trailing_content;
+        return Json::success;
+    }
+    for (;;) {
+        skipSpace(p, e);
+        if (p == e)
+            return Json::success;
+        if (*p != '{')
+            return Json::record_must_be_object;
+        ++p;
+        Json::Status status = parseRecord(p, e);
+        if (status != Json::success)
+            return status;
+        while (p < e && (*p == ' ' || *p == '\r' || *p == '\t'))
+            ++p;
+        if (p < e && *p != '\n')
+            return Json::trailing_content;
+    }
+}
+
+} // namespace detail
+
+const Column*
+Columns::find(const std::string& name) const
+{
+    for (const Column& column : columns)
+        if (column.name == name)
+            return &column;
+    return nullptr;
+}
+
+Columns
+toColumns(const Json& array, const std::vector<std::string>& fields)
+{
+    if (!array.isArray())
+        throw std::runtime_error("toColumns() expects an array of objects");
+    Columns out;
+    std::vector<detail::ColumnBuilder> builders;
+    detail::initColumns(fields, out, builders);
+    for (const Json& record : array.getArray()) {
+        if (!record.isObject())
+            throw std::runtime_error("column records must be objects");
+        const std::map<std::string, Json>& object = record.getObject();
+        for (size_t i = 0; i < fields.size(); ++i) {
+            auto it = object.find(fields[i]);
+            if (it != object.end())
+                builders[i].append(it->second);
+            else
+                builders[i].appendNull();
+        }
+        ++out.rows;
+    }
+    return out;
+}
+
+Json::Status
+parseColumns(const std::string& text,
+             const std::vector<std::string>& fields,
+             Columns& out)
+{
+    detail::ColumnParser parser(fields, out);
+    return parser.parse(text);
+}
+
+[[noreturn]] static void
+throwTypeMismatch(const char* expected, const Json& value)
+{
+    throw std::runtime_error(std::string("expected ") + expected + " but found " +
+                             typeName(value));
+}
+
+Reader::Reader(const char* p, const char* e) : p_(p), e_(e), depth_(DEPTH)
+{
+}
+
+Json::Type
+Reader::peek()
+{
+    if (status_ != Json::success)
+        return Json::Null;
+    while (p_ < e_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t'))
+        ++p_;
+    if (p_ == e_)
+        return Json::Null;
+    switch (*p_) {
+        case '{':
+            return Json::Object;
+        case '[':
+            return Json::Array;
+        case '"':
+            return Json::String;
+        case 't':
+        case 'f':
+            return Json::Bool;
+        case 'n':
+            return Json::Null;
+        default:
+            return Json::Long;
+    }
+}
+
+// Reads a scalar into value_. A container found instead is skipped, and
+// value_ becomes an empty one so the caller can report the mismatch.
+bool
+Reader::readValue()
+{
+    if (status_ != Json::success)
+        return false;
+    value_.clear();
+    switch (peek()) {
+        case Json::Object:
+        case Json::Array:
+            if (*p_ == '{')
+                value_.setObject();
+            else
+                value_.setArray();
+            status_ = Json::skip(p_, e_, 0, depth_);
+            break;
+        default:
+            status_ = Json::parse(value_, p_, e_, 0, depth_);
+            break;
+    }
+    if (status_ == Json::absent_value)
+        status_ = Json::unexpected_eof;
+    return status_ == Json::success;
+}
+
+bool
+Reader::enter(char open)
+{
+    if (status_ != Json::success)
+        return false;
+    while (p_ < e_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t'))
+        ++p_;
+    if (p_ < e_ && *p_ == open) {
+        if (depth_ == 1) {
+            status_ = Json::depth_exceeded;
+            return false;
+        }
+        ++p_;
+        --depth_;
+        first_ = true;
+        return true;
+    }
+    // Let the parser name the syntax error, or find out what the value
+    // actually is so the mismatch can be reported.
+    if (readValue() && !value_.isNull())
+        throwTypeMismatch(open == '{' ? "object" : "array", value_);
+    return false;
+}
+
+bool
+Reader::beginObject()
+{
+    return enter('{');
+}
+
+bool
+Reader::beginArray()
+{
+    return enter('[');
+}
+
+bool
+Reader::nextKey()
+{
+    if (status_ != Json::success)
+        return false;
+    key_.clear();
+    int context = first_ ? KEY | OBJECT : KEY | COMMA | OBJECT;
+    status_ = Json::parse(key_, p_, e_, context, depth_);
+    if (status_ == Json::absent_value) {
+        status_ = Json::success;
+        first_ = false;
+        ++depth_;
+        return false;
+    }
+    if (status_ != Json::success)
+        return false;
+    first_ = false;
+    while (p_ < e_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t'))
+        ++p_;
+    if (p_ == e_) {
+        status_ = Json::unexpected_eof;
+        return false;
+    }
+    if (*p_ != ':') {
+        status_ = Json::missing_colon;
+        return false;
+    }
+    ++p_;
+    return true;
+}
+
+bool
+Reader::nextElement()
+{
+    if (status_ != Json::success)
+        return false;
+    while (p_ < e_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t'))
+        ++p_;
+    if (p_ == e_) {
+        status_ = Json::unexpected_eof;
+        return false;
+    }
+    if (*p_ == ']') {
+        ++p_;
+        first_ = false;
+        ++depth_;
+        return false;
+    }
+    if (first_) {
+        first_ = false;
+        return true;
+    }
+    if (*p_ != ',') {
+        status_ = Json::missing_comma;
+        return false;
+    }
+    ++p_;
+    return true;
+}
+
+void
+Reader::read(bool& value)
+{
+    if (!readValue() || value_.isNull())
+        return;
+    if (!value_.isBool())
+        throwTypeMismatch("bool", value_);
+    value = value_.getBool();
+}
+
+void
+Reader::read(double& value)
+{
+    if (!readValue() || value_.isNull())
+        return;
+    if (!value_.isNumber())
+        throwTypeMismatch("number", value_);
+    value = value_.getNumber();
+}
+
+void
+Reader::read(std::string& value)
+{
+    if (!readValue() || value_.isNull())
+        return;
+    if (!value_.isString())
+        throwTypeMismatch("string", value_);
+    value.swap(value_.string_value);
+}
+
+void
+Reader::read(Json& value)
+{
+    if (status_ != Json::success)
+        return;
+    value_.clear();
+    status_ = Json::parse(value_, p_, e_, 0, depth_);
+    if (status_ == Json::absent_value)
+        status_ = Json::unexpected_eof;
+    if (status_ == Json::success)
+        value = std::move(value_);
+}
+
+void
+Reader::readInteger(long long& value, long long min, long long max)
+{
+    if (!readValue() || value_.isNull())
+        return;
+    if (!value_.isLong())
+        throwTypeMismatch("integer", value_);
+    if (value_.long_value < min || value_.long_value > max)
+        throw std::runtime_error("integer out of range: " + value_.toString());
+    value = value_.long_value;
+}
+
+void
+Reader::readUnsigned(unsigned long long& value, unsigned long long max)
+{
+    if (!readValue() || value_.isNull())
+        return;
+    unsigned long long x;
+    if (value_.isLong() && value_.long_value >= 0) {
+        x = value_.long_value;
+    } else if (value_.isDouble() && value_.double_value >= 9223372036854775808.0 &&
+               value_.double_value < 18446744073709551616.0 &&
+               value_.double_value == std::floor(value_.double_value)) {
+        // Json(unsigned long long) stores values past LLONG_MAX this way.
+        x = static_cast<unsigned long long>(value_.double_value);
+    } else if (value_.isNumber()) {
+        throw std::runtime_error("integer out of range: " + value_.toString());
+    } else {
+        throwTypeMismatch("integer", value_);
+    }
+    if (x > max)
+        throw std::runtime_error("integer out of range: " + value_.toString());
+    value = x;
+}
+
+void
+Reader::skip()
+{
+    if (status_ != Json::success)
+        return;
+    status_ = Json::skip(p_, e_, 0, depth_);
+    if (status_ == Json::absent_value)
+        status_ = Json::unexpected_eof;
+}
+
+Json::Status
+Reader::finish()
+{
+    if (status_ != Json::success)
+        return status_;
+    Json rest;
+    if (Json::parse(rest, p_, e_, 0, DEPTH) != Json::absent_value)
+        return Json::trailing_content;
+    return Json::success;
+}
+
+void
+Writer::separate()
+{
+    if (!first_)
+        out_ += ',';
+    first_ = false;
+}
+
+void
+Writer::beginObject()
+{
+    separate();
+    out_ += '{';
+    first_ = true;
+}
+
+void
+Writer::endObject()
+{
+    out_ += '}';
+    first_ = false;
+}
+
+void
+Writer::beginArray()
+{
+    separate();
+    out_ += '[';
+    first_ = true;
+}
+
+void
+Writer::endArray()
+{
+    out_ += ']';
+    first_ = false;
+}
+
+void
+Writer::key(const char* quoted, size_t size)
+{
+    separate();
+    out_.append(quoted, size);
+    first_ = true;
+}
+
+void
+Writer::write(bool value)
+{
+    separate();
+    out_ += value ? "true" : "false";
+}
+
+void
+Writer::write(long long value)
+{
+    char buf[64];
+    separate();
+    out_.append(buf, LongToString(buf, value) - buf);
+}
+
+void
+Writer::write(unsigned long long value)
+{
+    write(Json(value));
+}
+
+void
+Writer::write(float value)
+{
+    write(Json(value));
+}
+
+void
+Writer::write(double value)
+{
+    write(Json(value));
+}
+
+void
+Writer::write(const std::string& value)
+{
+    separate();
+    Json::stringify(out_, value);
+}
+
+void
+Writer::write(const Json& value)
+{
+    separate();
+    value.marshal(out_, false, 0);
+}
+
+ChunkParser::ChunkParser() : depth_(DEPTH)
+{
+    STAT_ADD(documents, 1);
+}
+
+bool
+ChunkParser::feed(const char* data, size_t size)
+{
+    if (done_)
+        return false;
+    STAT_ADD(bytesParsed, size);
+    if (pending_.empty()) {
+        const char* p = process(data, data + size);
+        pending_.assign(p, data + size - p);
+    } else {
+        pending_.append(data, size);
+        const char* p = process(pending_.data(), pending_.data() + pending_.size());
+        pending_.erase(0, p - pending_.data());
+    }
+    return !done_;
+}
+
+std::pair<Json::Status, Json>
+ChunkParser::finish()
+{
+    if (!done_) {
+        eof_ = true;
+        process(pending_.data(), pending_.data() + pending_.size());
+        pending_.clear();
+    }
+    return std::make_pair(status_, std::move(root_));
+}
+
+// Consumes as much of [p,e) as it can, mirroring Json::parse() one call
+// at a time: stack_ holds the containers being filled and context_ and
+// depth_ are the arguments of the call in progress. Strings and numbers
+// are handed to Json::parse() once their last byte is here. Returns the
+// start of an unfinished token, which the next chunk continues.
+const char*
+ChunkParser::process(const char* p, const char* e)
+{
+    while (!done_) {
+        if (trailing_) {
+            for (; p < e; ++p) {
+                if (*p != ' ' && *p != '\n' && *p != '\r' && *p != '\t') {
+                    fail(Json::trailing_content);
+                    break;
+                }
+            }
+            if (eof_)
+                done_ = true;
+            return e;
+        }
+        if (p == e) {
+            if (!eof_)
+                return p;
+            Json absent;
+            complete(depth_ == DEPTH ? Json::absent_value : Json::unexpected_eof, absent);
+            continue;
+        }
+        const char* t;
+        switch (*p) {
+            case ' ':
+            case '\n':
+            case '\r':
+            case '\t':
+                ++p;
+                continue;
+
+            case ',':
+                if (!(context_ & COMMA)) {
+                    fail(Json::unexpected_comma);
+                    continue;
+                }
+                context_ = 0;
+                ++p;
+                continue;
+
+            case ':':
+                if (!(context_ & COLON)) {
+                    fail(Json::unexpected_colon);
+                    continue;
+                }
+                context_ = 0;
+                ++p;
+                continue;
+
+            case ']':
+            case '}': {
+                if (!(context_ & (*p == ']' ? ARRAY : OBJECT))) {
+                    fail(*p == ']' ? Json::unexpected_end_of_array
+                                   : Json::unexpected_end_of_object);
+                    continue;
+                }
+                ++p;
+                Json absent;
+                complete(Json::absent_value, absent);
+                continue;
+            }
+
+            case '[':
+            case '{': {
+                if (context_ & KEY) {
+                    fail(Json::object_key_must_be_string);
+                    continue;
+                }
+                if (context_ & COLON) {
+                    fail(Json::missing_colon);
+                    continue;
+                }
+                if (context_ & COMMA) {
+                    fail(Json::missing_comma);
+                    continue;
+                }
+                stack_.emplace_back();
+                Frame& frame = stack_.back();
+                frame.depth = depth_;
+                frame.wantValue = false;
+                STAT_MAX(maxDepth, DEPTH - depth_ + 1);
+                if (*p++ == '[') {
+                    frame.value.setArray();
+                    STAT_ADD(arrays, 1);
+                    call(ARRAY, depth_ - 1);
+                } else {
+                    frame.value.setObject();
+                    STAT_ADD(objects, 1);
+                    call(KEY | OBJECT, depth_ - 1);
+                }
+                continue;
+            }
+
+            case '"':
+                if (context_ & COLON) {
+                    fail(Json::missing_colon);
+                    continue;
+                }
+                if (context_ & COMMA) {
+                    fail(Json::missing_comma);
+                    continue;
+                }
+                t = scanString(p, e);
+                break;
+
+            default:
+                t = scanWord(p, e);
+                break;
+        }
+        if (!t) {
+            if (!eof_)
+                return p;
+            t = e;
+        }
+        scanned_ = 0;
+        escape_ = false;
+        Json value;
+        Json::Status status = Json::parse(value, p, t, context_, depth_);
+        complete(status, value);
+    }
+    return e;
+}
+
+// Returns the end of the string starting at p, or null if its closing
+// quote hasn't arrived. Escapes are only skipped here; Json::parse()
+// validates them.
+const char*
+ChunkParser::scanString(const char* p, const char* e)
+{
+    const char* q = p + (scanned_ ? scanned_ : 1);
+    for (; q < e; ++q) {
+        if (escape_) {
+            escape_ = false;
+        } else if (*q == '\\') {
+            escape_ = true;
+        } else if (*q == '"') {
+            return q + 1;
+        }
+    }
+    scanned_ = e - p;
+    return nullptr;
+}
+
+static bool
+IsWordByte(int c)
+{
+    return isalnum(c & 255) || c == '-' || c == '+' || c == '.';
+}
+
+// Whitespace that StringToDouble() skips after a number.
+static bool
+IsDoubleSpace(int c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Returns the end of the number or literal starting at p, or null if it
+// may continue in the next chunk. A double swallows the spaces after it
+// and Json::parse() then checks the byte past them, so the token extends
+// one byte beyond any trailing spaces. A byte that can't start a word is
+// a token of its own, so Json::parse() can report it.
+const char*
+ChunkParser::scanWord(const char* p, const char* e)
+{
+    const char* q = p + (scanned_ ? scanned_ : 1);
+    if (!IsWordByte(*p))
+        return q;
+    if (!IsDoubleSpace(q[-1]))
+        while (q < e && IsWordByte(*q))
+            ++q;
+    for (; q < e; ++q)
+        if (!IsDoubleSpace(*q))
+            return IsDoubleSpace(q[-1]) ? q + 1 : q;
+    scanned_ = e - p;
+    return nullptr;
+}
+
+void
+ChunkParser::call(int context, int depth)
+{
+    context_ = context;
+    depth_ = depth;
+    if (!depth)
+        fail(Json::depth_exceeded);
+}
+
+// Delivers the result of the call in progress to the container waiting
+// for it, closing containers as their ends arrive.
+void
+ChunkParser::complete(Json::Status status, Json& value)
+{
+    if (status != Json::success && status != Json::absent_value)
+        return fail(status);
+    if (stack_.empty()) {
+        if (status == Json::absent_value) {
+            status_ = Json::absent_value;
+            done_ = true;
+        } else {
+            root_ = std::move(value);
+            trailing_ = true;
+        }
+        return;
+    }
+    Frame& frame = stack_.back();
+    if (status == Json::absent_value) {
+        if (frame.wantValue)
+            return fail(Json::object_missing_value);
+        Json done = std::move(frame.value);
+        depth_ = frame.depth;
+        stack_.pop_back();
+        return complete(Json::success, done);
+    }
+    if (frame.value.isArray()) {
+        frame.value.array_value.emplace_back(std::move(value));
+        call(ARRAY | COMMA, frame.depth - 1);
+    } else if (!frame.wantValue) {
+        if (!value.isString())
+            return fail(Json::object_key_must_be_string);
+        STAT_ADD(keys, 1);
+        frame.key = std::move(value);
+        frame.wantValue = true;
+        call(COLON, frame.depth - 1);
+    } else {
+        frame.value.object_value.emplace(std::move(frame.key.string_value), std::move(value));
+        frame.key.clear();
+        frame.wantValue = false;
+        call(KEY | COMMA | OBJECT, frame.depth - 1);
+    }
+}
+
+// Stops parsing. Like Json::parse(), the partial result keeps the
+// members of the outermost container that were complete.
+void
+ChunkParser::fail(Json::Status status)
+{
+    status_ = status;
+    done_ = true;
+    if (!stack_.empty())
+        root_ = std::move(stack_.front().value);
+    stack_.clear();
+}
+
+ChunkWriter::ChunkWriter(const Json& json, bool pretty) : next_(&json), pretty_(pretty)
+{
+}
+
+// Walks the tree like Json::marshal(), with an explicit stack in place of
+// its recursion so the walk can stop anywhere between tokens.
+bool
+ChunkWriter::write(std::string& out, size_t size)
+{
+    size_t limit = out.size() + size;
+    do {
+        if (next_) {
+            const Json& json = *next_;
+            next_ = nullptr;
+            if (json.isArray()) {
+                out += '[';
+                stack_.push_back(Frame{ &json, 0, {}, indent_ });
+            } else if (json.isObject()) {
+                out += '{';
+                stack_.push_back(Frame{ &json, 0, json.object_value.begin(), indent_ });
+            } else {
+                json.marshal(out, pretty_, indent_);
+            }
+            continue;
+        }
+        if (stack_.empty())
+            return false;
+        Frame& frame = stack_.back();
+        if (frame.json->isArray()) {
+            const std::vector<Json>& array = frame.json->array_value;
+            if (frame.index == array.size()) {
+                out += ']';
+                stack_.pop_back();
+                continue;
+            }
+            if (frame.index) {
+                out += ',';
+                if (pretty_)
+                    out += ' ';
+            }
+            next_ = &array[frame.index++];
+            indent_ = frame.indent;
+            continue;
+        }
+        const std::map<std::string, Json>& object = frame.json->object_value;
+        bool multiline = pretty_ && object.size() > 1;
+        if (frame.key == object.end()) {
+            if (multiline) {
+                out += '\n';
+                for (int j = 0; j < frame.indent; ++j)
+                    out += "  ";
+            }
+            out += '}';
+            stack_.pop_back();
+            continue;
+        }
+        if (frame.key != object.begin())
+            out += ',';
+        indent_ = frame.indent;
+        if (multiline) {
+            out += '\n';
+            ++indent_;
+            for (int j = 0; j < indent_; ++j)
+                out += "  ";
+        }
+        Json::stringify(out, frame.key->first);
+        out += ':';
+        if (pretty_)
+            out += ' ';
+        next_ = &frame.key->second;
+        ++frame.key;
+    } while (out.size() < limit);
+    return next_ || !stack_.empty();
+}
+
+void
+read(Reader& r, bool& value)
+{
+    r.read(value);
+}
+
+void
+read(Reader& r, float& value)
+{
+    double x = value;
+    r.read(x);
+    value = static_cast<float>(x);
+}
+
+void
+read(Reader& r, double& value)
+{
+    r.read(value);
+}
+
+void
+read(Reader& r, std::string& value)
+{
+    r.read(value);
+}
+
+void
+read(Reader& r, Json& value)
+{
+    r.read(value);
+}
+
+void
+write(Writer& w, bool value)
+{
+    w.write(value);
+}
+
+void
+write(Writer& w, float value)
+{
+    w.write(value);
+}
+
+void
+write(Writer& w, double value)
+{
+    w.write(value);
+}
+
+void
+write(Writer& w, const std::string& value)
+{
+    w.write(value);
+}
+
+void
+write(Writer& w, const char* value)
+{
+    w.write(std::string(value));
+}
+
+void
+write(Writer& w, const Json& value)
+{
+    w.write(value);
+}
+
+namespace detail {
+
+static constexpr size_t kAnalyzeTopKeys = 32;
+
+static uint64_t
+mixHash(uint64_t h, uint64_t x)
+{
+    h ^= x;
+    h *= 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+// Accumulates the statistics behind analyze() and analyzeText(). Each
+// walk returns a hash of the subtree it covered, so identical containers
+// are found without keeping copies. Object hashes ignore member order,
+// which makes the tree and text walks agree.
+class ShapeAnalyzer
+{
+  public:
+    struct Subtree
+    {
+        uint64_t hash;
+        uint64_t nodes;
+        bool number;
+    };
+
+    Subtree walk(const Json& value, size_t depth);
+    Subtree walk(Reader& reader, size_t depth);
+    Json report() const;
+
+  private:
+    uint64_t types_[Json::Object + 1] = {};
+    std::vector<uint64_t> depths_;
+    std::unordered_map<std::string, uint64_t> keys_;
+    uint64_t keyCount_ = 0;
+    std::unordered_set<uint64_t> shapes_;
+    std::vector<size_t> arrayLengths_;
+    uint64_t numericArrays_ = 0;
+    std::vector<size_t> stringLengths_;
+    std::unordered_set<uint64_t> subtrees_;
+    uint64_t repeated_ = 0;
+    uint64_t repeatedNodes_ = 0;
+
+    void visit(Json::Type type, size_t depth);
+    uint64_t key(const std::string& name);
+    Subtree scalar(const Json& value, size_t depth);
+    Subtree endArray(Subtree tree, size_t length, bool numeric);
+    Subtree endObject(Subtree tree, uint64_t shape);
+    void container(const Subtree& tree);
+};
+
+void
+ShapeAnalyzer::visit(Json::Type type, size_t depth)
+{
+    ++types_[type];
+    if (depths_.size() <= depth)
+        depths_.resize(depth + 1);
+    ++depths_[depth];
+}
+
+uint64_t
+ShapeAnalyzer::key(const std::string& name)
+{
+    ++keys_[name];
+    ++keyCount_;
+    return mixHash(Json::String, std::hash<std::string>()(name));
+}
+
+ShapeAnalyzer::Subtree
+ShapeAnalyzer::scalar(const Json& value, size_t depth)
+{
+    visit(value.getType(), depth);
+    uint64_t bits = 0;
+    if (value.isBool()) {
+        bits = value.getBool();
+    } else if (value.isLong()) {
+        bits = static_cast<uint64_t>(value.getLong());
+    } else if (value.isNumber()) {
+        double number = value.getNumber();
+        std::memcpy(&bits, &number, sizeof(bits));
+    } else if (value.isString()) {
+        stringLengths_.push_back(value.getString().size());
+        bits = std::hash<std::string>()(value.getString());
+    }
+    return { mixHash(value.getType(), bits), 1, value.isNumber() };
+}
+
+ShapeAnalyzer::Subtree
+ShapeAnalyzer::endArray(Subtree tree, size_t length, bool numeric)
+{
+    arrayLengths_.push_back(length);
+    if (numeric && length)
+        ++numericArrays_;
+    tree.hash = mixHash(tree.hash, length);
+    container(tree);
+    return tree;
+}
+
+ShapeAnalyzer::Subtree
+ShapeAnalyzer::endObject(Subtree tree, uint64_t shape)
+{
+    shapes_.insert(shape);
+    tree.hash = mixHash(Json::Object, tree.hash);
+    container(tree);
+    return tree;
+}
+
+void
+ShapeAnalyzer::container(const Subtree& tree)
+{
+    if (tree.nodes > 1 && !subtrees_.insert(tree.hash).second) {
+        ++repeated_;
+        repeatedNodes_ += tree.nodes;
+    }
+}
+
+ShapeAnalyzer::Subtree
+ShapeAnalyzer::walk(const Json& value, size_t depth)
+{
+    if (value.isArray()) {
+        visit(Json::Array, depth);
+        Subtree tree = { Json::Array, 1, false };
+        bool numeric = true;
+        for (const Json& item : value.getArray()) {
+            Subtree child = walk(item, depth + 1);
+            tree.hash = mixHash(tree.hash, child.hash);
+            tree.nodes += child.nodes;
+            numeric = numeric && child.number;
+        }
+        return endArray(tree, value.getArray().size(), numeric);
+    }
+    if (value.isObject()) {
+        visit(Json::Object, depth);
+        Subtree tree = { 0, 1, false };
+        uint64_t shape = 0;
+        for (const auto& member : value.getObject()) {
+            uint64_t name = key(member.first);
+            Subtree child = walk(member.second, depth + 1);
+            shape += name;
+            tree.hash += mixHash(name, child.hash);
+            tree.nodes += child.nodes;
+        }
+        return endObject(tree, shape);
+    }
+    return scalar(value, depth);
+}
+
+ShapeAnalyzer::Subtree
+ShapeAnalyzer::walk(Reader& reader, size_t depth)
+{
+    switch (reader.peek()) {
+        case Json::Array: {
+            visit(Json::Array, depth);
+            Subtree tree = { Json::Array, 1, false };
+            size_t length = 0;
+            bool numeric = true;
+            if (reader.beginArray()) {
+                while (reader.nextElement()) {
+                    Subtree child = walk(reader, depth + 1);
+                    tree.hash = mixHash(tree.hash, child.hash);
+                    tree.nodes += child.nodes;
+                    numeric = numeric && child.number;
+                    ++length;
+                }
+            }
+            return endArray(tree, length, numeric);
+        }
+        case Json::Object: {
+            visit(Json::Object, depth);
+            Subtree tree = { 0, 1, false };
+            uint64_t shape = 0;
+            if (reader.beginObject()) {
+                while (reader.nextKey()) {
+                    uint64_t name = key(reader.key());
+                    Subtree child = walk(reader, depth + 1);
+                    shape += name;
+                    tree.hash += mixHash(name, child.hash);
+                    tree.nodes += child.nodes;
+                }
+            }
+            return endObject(tree, shape);
+        }
+        default: {
+            Json value;
+            reader.read(value);
+            return scalar(value, depth);
+        }
+    }
+}
+
+static Json
+describeLengths(std::vector<size_t> lengths)
+{
+    Json json;
+    std::sort(lengths.begin(), lengths.end());
+    size_t count = lengths.size();
+    unsigned long long sum = 0;
+    for (size_t length : lengths)
+        sum += length;
+    auto percentile = [&](double p) {
+        if (!count)
+            return 0LL;
+        size_t rank = static_cast<size_t>(std::ceil(p * count));
+        return static_cast<long long>(lengths[rank ? rank - 1 : 0]);
+    };
+    json["min"] = count ? static_cast<long long>(lengths.front()) : 0LL;
+    json["max"] = count ? static_cast<long long>(lengths.back()) : 0LL;
+    json["mean"] = count ? static_cast<double>(sum) / count : 0.0;
+    json["p50"] = percentile(0.50);
+    json["p90"] = percentile(0.90);
+    json["p99"] = percentile(0.99);
+    return json;
+}
+
+Json
+ShapeAnalyzer::report() const
+{
+    Json json;
+    uint64_t nodes = 0;
+    Json& types = json["types"];
+    for (int type = Json::Null; type <= Json::Object; ++type) {
+        nodes += types_[type];
+        types[kTypeNames[type]] = static_cast<long long>(types_[type]);
+    }
+    json["nodes"] = static_cast<long long>(nodes);
+    uint64_t numbers = types_[Json::Long] + types_[Json::Float] + types_[Json::Double];
+    uint64_t scalars = numbers + types_[Json::String];
+    json["numericRatio"] = scalars ? static_cast<double>(numbers) / scalars : 0.0;
+
+    typedef std::pair<std::string, uint64_t> KeyCount;
+    std::vector<KeyCount> keys(keys_.begin(), keys_.end());
+    std::sort(keys.begin(), keys.end(), [](const KeyCount& a, const KeyCount& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    if (keys.size() > kAnalyzeTopKeys)
+        keys.resize(kAnalyzeTopKeys);
+    Json& keyReport = json["keys"];
+    keyReport["total"] = static_cast<long long>(keyCount_);
+    keyReport["distinct"] = static_cast<long long>(keys_.size());
+    Json& top = keyReport["top"];
+    top.setArray();
+    for (const auto& entry : keys) {
+        Json item;
+        item["key"] = entry.first;
+        item["count"] = static_cast<long long>(entry.second);
+        top.getArray().push_back(std::move(item));
+    }
+
+    Json& depth = json["depth"];
+    depth["max"] = depths_.empty() ? 0LL : static_cast<long long>(depths_.size() - 1);
+    Json& depthHistogram = depth["histogram"];
+    depthHistogram.setArray();
+    for (uint64_t count : depths_)
+        depthHistogram.getArray().push_back(static_cast<long long>(count));
+
+    Json& arrays = json["arrays"];
+    arrays["count"] = static_cast<long long>(arrayLengths_.size());
+    arrays["numeric"] = static_cast<long long>(numericArrays_);
+    arrays["lengths"] = describeLengths(arrayLengths_);
+    // Power of two buckets: 0, 1, 2-3, 4-7 and so on.
+    std::vector<uint64_t> buckets;
+    for (size_t length : arrayLengths_) {
+        size_t bucket = 0;
+        while (length >> bucket)
+            ++bucket;
+        if (buckets.size() <= bucket)
+            buckets.resize(bucket + 1);
+        ++buckets[bucket];
+    }
+    Json& lengthHistogram = arrays["histogram"];
+    lengthHistogram.setArray();
+    for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+        if (!buckets[bucket])
+            continue;
+        Json item;
+        item["min"] = bucket ? 1LL << (bucket - 1) : 0LL;
+        item["max"] = bucket ? (1LL << bucket) - 1 : 0LL;
+        item["count"] = static_cast<long long>(buckets[bucket]);
+        lengthHistogram.getArray().push_back(std::move(item));
+    }
+
+    Json& strings = json["strings"];
+    strings["count"] = static_cast<long long>(stringLengths_.size());
+    strings["lengths"] = describeLengths(stringLengths_);
+
+    Json& objects = json["objects"];
+    objects["count"] = static_cast<long long>(types_[Json::Object]);
+    objects["shapes"] = static_cast<long long>(shapes_.size());
+
+    Json& repeated = json["repeatedSubtrees"];
+    repeated["count"] = static_cast<long long>(repeated_);
+    repeated["nodes"] = static_cast<long long>(repeatedNodes_);
+    return json;
+}
+
+} // namespace detail
+
+Json
+analyze(const Json& value)
+{
+    detail::ShapeAnalyzer analyzer;
+    analyzer.walk(value, 0);
+    return analyzer.report();
+}
+
+std::pair<Json::Status, Json>
+analyzeText(const char* data, size_t size)
+{
+    detail::ShapeAnalyzer analyzer;
+    Reader reader(data, data + size);
+    analyzer.walk(reader, 0);
+    Json::Status status = reader.finish();
+    if (status != Json::success)
+        return { status, Json() };
+    return { status, analyzer.report() };
+}
+
+std::pair<Json::Status, Json>
+analyzeText(const std::string& text)
+{
+    return analyzeText(text.data(), text.size());
+}
+
+namespace detail {
+
+// One parallelFor() call. Subranges count themselves off remaining as
+// they finish, and the one that reaches zero sets finished, which is
+// what the caller waits for.
+struct ForkJoin
+{
+    const std::function<void(size_t, size_t)>* fn;
+    size_t grain;
+    std::atomic<size_t> remaining;
+    bool finished = false; // guarded by the pool's sleepLock
+    std::atomic<bool> failed{ false };
+    std::mutex errorLock;
+    std::exception_ptr error;
+};
+
+struct RangeTask
+{
+    ForkJoin* job;
+    size_t begin;
+    size_t end;
+};
+
+struct TaskDeque
+{
+    std::mutex lock;
+    std::deque<RangeTask> tasks;
+};
+
+// The pool the current thread works for, and its deque there.
+static thread_local const void* tPool;
+static thread_local size_t tDeque;
+
+} // namespace detail
+
+struct WorkStealingExecutor::State
+{
+    size_t workers;
+    std::vector<detail::TaskDeque> deques; // one per worker, then the shared one
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued{ 0 };
+    std::atomic<bool> stop{ false };
+    std::mutex sleepLock;
+    std::condition_variable wake;
+
+    explicit State(size_t n) : workers(n), deques(n + 1)
+    {
+    }
+
+    size_t self() const
+    {
+        return detail::tPool == this ? detail::tDeque : workers;
+    }
+
+    void push(size_t slot, const detail::RangeTask& task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(deques[slot].lock);
+            deques[slot].tasks.push_back(task);
+        }
+        queued.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(sleepLock);
+        }
+        wake.notify_one();
+    }
+
+    // Takes the newest task from slot, else steals the oldest elsewhere.
+    bool take(size_t slot, detail::RangeTask& task)
+    {
+        if (!queued.load())
+            return false;
+        for (size_t i = 0; i < deques.size(); ++i) {
+            detail::TaskDeque& d = deques[(slot + i) % deques.size()];
+            std::lock_guard<std::mutex> lock(d.lock);
+            if (d.tasks.empty())
+                continue;
+            if (!i) {
+                task = d.tasks.back();
+                d.tasks.pop_back();
+            } else {
+                task = d.tasks.front();
+                d.tasks.pop_front();
+            }
+            queued.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t slot, detail::RangeTask task)
+    {
+        detail::ForkJoin& job = *task.job;
+        while (task.end - task.begin > job.grain) {
+            size_t mid = task.begin + (task.end - task.begin) / 2;
+            push(slot, { &job, mid, task.end });
+            task.end = mid;
+        }
+        if (!job.failed.load()) {
+            try {
+                (*job.fn)(task.begin, task.end);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(job.errorLock);
+                if (!job.failed.exchange(true))
+                    job.error = std::current_exception();
+            }
+        }
+        if (job.remaining.fetch_sub(task.end - task.begin) == task.end - task.begin) {
+            // The caller may free job as soon as it sees finished, so
+            // nothing here touches job after the lock is released.
+            {
+                std::lock_guard<std::mutex> lock(sleepLock);
+                job.finished = true;
+            }
+            wake.notify_all();
+        }
+    }
+
+    void work(size_t slot)
+    {
+        detail::tPool = this;
+        detail::tDeque = slot;
+        detail::RangeTask task;
+        for (;;) {
+            if (take(slot, task)) {
+                run(slot, task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepLock);
+            wake.wait(lock, [this] { return stop.load() || queued.load(); });
+            if (stop.load())
+                return;
+        }
+    }
+};
+
+WorkStealingExecutor::WorkStealingExecutor(size_t threads)
+{
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    state_ = new State(threads - 1);
+    for (size_t i = 0; i < state_->workers; ++i)
+        state_->threads.emplace_back(&State::work, state_, i);
+}
+
+WorkStealingExecutor::~WorkStealingExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock(state_->sleepLock);
+        state_->stop = true;
+    }
+    state_->wake.notify_all();
+    for (std::thread& thread : state_->threads)
+        thread.join();
+    delete state_;
+}
+
+size_t
+WorkStealingExecutor::concurrency() const
+{
+    return state_->workers + 1;
+}
+
+void
+WorkStealingExecutor::parallelFor(size_t begin,
+                                  size_t end,
+                                  size_t grain,
+                                  const std::function<void(size_t, size_t)>& fn)
+{
+    if (begin >= end)
+        return;
+    if (!grain)
+        grain = std::max<size_t>(1, (end - begin) / (concurrency() * 8));
+    if (!state_->workers) {
+        for (size_t i = begin; i < end; i += std::min(grain, end - i))
+            fn(i, std::min(end, i + grain));
+        return;
+    }
+    detail::ForkJoin job;
+    job.fn = &fn;
+    job.grain = grain;
+    job.remaining = end - begin;
+    const size_t slot = state_->self();
+    state_->run(slot, { &job, begin, end });
+    // Help with whatever is queued until every subrange has finished,
+    // including ones that other threads stole from us. With nothing left
+    // to take, sleep until the last subrange finishes or more work is
+    // queued, since a nested parallelFor() may still push some of ours.
+    detail::RangeTask task;
+    for (;;) {
+        if (state_->take(slot, task)) {
+            state_->run(slot, task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(state_->sleepLock);
+        state_->wake.wait(lock, [&] { return job.finished || state_->queued.load(); });
+        if (job.finished)
+            break;
+    }
+    if (job.error)
+        std::rethrow_exception(job.error);
+}
+
+static std::atomic<Executor*> gExecutor{ nullptr };
+
+Executor&
+defaultExecutor()
+{
+    if (Executor* executor = gExecutor.load())
+        return *executor;
+    static WorkStealingExecutor pool;
+    return pool;
+}
+
+Executor*
+setExecutor(Executor* executor)
+{
+    return gExecutor.exchange(executor);
+}
+
+// Input a batch task should cover when the caller gives no grain.
+static const size_t kBatchTaskBytes = 64 * 1024;
+
+void
+Json::parseBatch(const Buffer* inputs,
+                 size_t count,
+                 std::pair<Status, Json>* results,
+                 const BatchOptions& options)
+{
+    Executor& executor = options.executor ? *options.executor : defaultExecutor();
+    size_t grain = options.grain;
+    if (!grain && count) {
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; ++i)
+            bytes += inputs[i].size;
+        // Keep several tasks per thread so stealing can even out
+        // documents of uneven size.
+        size_t average = std::max<size_t>(1, bytes / count);
+        size_t perThread = count / (executor.concurrency() * 4);
+        grain = std::max<size_t>(1, std::min(kBatchTaskBytes / average, perThread));
+    }
+    // Each task parses a run of neighbouring documents straight into its
+    // own slots, so threads share no parser state and glibc hands each
+    // thread its own malloc arena.
+    executor.parallelFor(0, count, grain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            results[i] = parse(inputs[i].data, inputs[i].size);
+    });
+}
+
+std::vector<std::pair<Json::Status, Json>>
+Json::parseBatch(const std::vector<std::string>& texts)
+{
+    return parseBatch(texts, BatchOptions());
+}
+
+std::vector<std::pair<Json::Status, Json>>
+Json::parseBatch(const std::vector<std::string>& texts, const BatchOptions& options)
+{
+    std::vector<Buffer> inputs;
+    inputs.reserve(texts.size());
+    for (const std::string& text : texts)
+        inputs.push_back({ text.data(), text.size() });
+    std::vector<std::pair<Status, Json>> results(texts.size());
+    parseBatch(inputs.data(), inputs.size(), results.data(), options);
+    return results;
+}
+
+namespace detail {
+
+struct SharedVersion
+{
+    Json json;
+    uint64_t number;
+};
+
+// Hazard pointer slot. Records live for the whole process: a Snapshot
+// claims an idle one, and writers won't free a version one points at.
+struct HazardRecord
+{
+    std::atomic<const SharedVersion*> pointer{ nullptr };
+    std::atomic<bool> active{ false };
+    HazardRecord* next = nullptr;
+};
+
+static std::atomic<HazardRecord*> gHazards{ nullptr };
+
+// Each thread holds on to the last record it released, which saves
+// walking the list on every read, and gives it back when it exits.
+struct SpareHazard
+{
+    HazardRecord* record = nullptr;
+
+    ~SpareHazard()
+    {
+        if (record)
+            record->active.store(false);
+    }
+};
+
+static thread_local SpareHazard tSpareHazard;
+
+static HazardRecord*
+acquireHazard()
+{
+    if (HazardRecord* spare = tSpareHazard.record) {
+        tSpareHazard.record = nullptr;
+        return spare;
+    }
+    for (HazardRecord* r = gHazards.load(); r; r = r->next) {
+        bool idle = false;
+        if (!r->active.load() && r->active.compare_exchange_strong(idle, true))
+            return r;
+    }
+    HazardRecord* r = new HazardRecord;
+    r->active.store(true);
+    HazardRecord* head = gHazards.load();
+    do {
+        r->next = head;
+    } while (!gHazards.compare_exchange_weak(head, r));
+    return r;
+}
+
+static void
+releaseHazard(HazardRecord* r)
+{
+    r->pointer.store(nullptr);
+    if (!tSpareHazard.record)
+        tSpareHazard.record = r;
+    else
+        r->active.store(false);
+}
+
+} // namespace detail
+
+struct SharedDocument::State
+{
+    std::atomic<const detail::SharedVersion*> current;
+    std::mutex writeLock;
+    std::vector<const detail::SharedVersion*> retired;
+
+    // Swaps in a new version; writeLock must be held.
+    uint64_t install(Json json)
+    {
+        const detail::SharedVersion* old = current.load();
+        const detail::SharedVersion* version =
+          new detail::SharedVersion{ std::move(json), old->number + 1 };
+        current.store(version);
+        retired.push_back(old);
+        reclaim();
+        return version->number;
+    }
+
+    // Frees every retired version no hazard pointer refers to.
+    void reclaim()
+    {
+        std::vector<const detail::SharedVersion*> pinned;
+        for (detail::HazardRecord* r = detail::gHazards.load(); r; r = r->next)
+            if (const detail::SharedVersion* p = r->pointer.load())
+                pinned.push_back(p);
+        std::sort(pinned.begin(), pinned.end());
+        size_t kept = 0;
+        for (const detail::SharedVersion* version : retired) {
+            if (std::binary_search(pinned.begin(), pinned.end(), version))
+                retired[kept++] = version;
+            else
+                delete version;
+        }
+        retired.resize(kept);
+    }
+};
+
+SharedDocument::Snapshot::Snapshot(const detail::SharedVersion* version,
+                                   detail::HazardRecord* record)
+  : version_(version), record_(record)
+{
+}
+
+SharedDocument::Snapshot::Snapshot(Snapshot&& other)
+  : version_(other.version_), record_(other.record_)
+{
+    other.record_ = nullptr;
+}
+
+SharedDocument::Snapshot::~Snapshot()
+{
+    if (record_)
+        detail::releaseHazard(record_);
+}
+
+const Json&
+SharedDocument::Snapshot::operator*() const
+{
+    return version_->json;
+}
+
+const Json*
+SharedDocument::Snapshot::operator->() const
+{
+    return &version_->json;
+}
+
+uint64_t
+SharedDocument::Snapshot::version() const
+{
+    return version_->number;
+}
+
+SharedDocument::SharedDocument(Json json) : state_(new State)
+{
+    state_->current.store(new detail::SharedVersion{ std::move(json), 1 });
+}
+
+SharedDocument::~SharedDocument()
+{
+    delete state_->current.load();
+    for (const detail::SharedVersion* version : state_->retired)
+        delete version;
+    delete state_;
+}
+
+SharedDocument::Snapshot
+SharedDocument::read() const
+{
+    detail::HazardRecord* record = detail::acquireHazard();
+    const detail::SharedVersion* version = state_->current.load();
+    for (;;) {
+        // The version can't be freed once the hazard is visible, as long
+        // as it was still current after the hazard was stored.
+        record->pointer.store(version);
+        const detail::SharedVersion* again = state_->current.load();
+        if (again == version)
+            break;
+        version = again;
+    }
+    return Snapshot(version, record);
+}
+
+uint64_t
+SharedDocument::publish(Json json)
+{
+    std::lock_guard<std::mutex> lock(state_->writeLock);
+    return state_->install(std::move(json));
+}
+
+uint64_t
+SharedDocument::update(const std::function<void(Json&)>& fn)
+{
+    std::lock_guard<std::mutex> lock(state_->writeLock);
+    Json json(state_->current.load()->json);
+    fn(json);
+    return state_->install(std::move(json));
+}
+
+uint64_t
+SharedDocument::version() const
+{
+    return state_->current.load()->number;
+}
+
+size_t
+SharedDocument::retired() const
+{
+    std::lock_guard<std::mutex> lock(state_->writeLock);
+    return state_->retired.size();
+}
 
 const char*
 Json::StatusToString(Json::Status status)
@@ -3637,6 +6884,8 @@ Json::StatusToString(Json::Status status)
             return "overlong_utf8_0xffff";
         case object_missing_value:
             return "object_missing_value";
+        case record_must_be_object:
+            return "record_must_be_object";
         case illegal_utf8_character:
             return "illegal_utf8_character";
         case invalid_unicode_escape:
@@ -16,12 +16,25 @@
 // limitations under the License.
 
 #pragma once
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <map>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace jt {
 
+class Executor;
+
+namespace detail {
+class ColumnParser;
+struct HazardRecord;
+struct SharedVersion;
+} // namespace detail
+
 class Json
 {
   public:
@@ -60,6 +73,7 @@ class Json
         overlong_utf8_0x7ff,
         overlong_utf8_0xffff,
         object_missing_value,
+        record_must_be_object,
         illegal_utf8_character,
         invalid_unicode_escape,
         utf16_surrogate_in_utf8,
@@ -90,6 +104,31 @@ class Json
   public:
     static const char* StatusToString(Status);
     static std::pair<Status, Json> parse(const std::string&);
+    static std::pair<Status, Json> parse(const char*, size_t);
+
+    // Parses independent documents in parallel, storing each result at
+    // the index of its input. grain is documents per task, and zero picks
+    // it from the input sizes. Stats and profilers installed on the
+    // calling thread don't see documents parsed on other threads.
+    struct Buffer
+    {
+        const char* data;
+        size_t size;
+    };
+
+    struct BatchOptions
+    {
+        Executor* executor = nullptr; // defaultExecutor() when null
+        size_t grain = 0;
+    };
+
+    static void parseBatch(const Buffer*,
+                           size_t,
+                           std::pair<Status, Json>*,
+                           const BatchOptions&);
+    static std::vector<std::pair<Status, Json>> parseBatch(const std::vector<std::string>&);
+    static std::vector<std::pair<Status, Json>> parseBatch(const std::vector<std::string>&,
+                                                           const BatchOptions&);
 
     Json(const Json&);
     Json(Json&&);
@@ -211,6 +250,7 @@ class Json
     size_t updateJsonpath(const std::string&, const Json&);
     size_t updateJsonpath(const std::string&, Json&&);
     size_t deleteJsonpath(const std::string&);
+    Json aggregateJsonpath(const std::string&) const;
 
     Json& operator=(const Json&);
     Json& operator=(Json&&);
@@ -229,6 +269,614 @@ class Json
     static void stringify(std::string&, const std::string&);
     static void serialize(std::string&, const std::string&);
     static Status parse(Json&, const char*&, const char*, int, int);
+    static Status skip(const char*&, const char*, int, int, bool* = nullptr);
+
+    friend class detail::ColumnParser;
+    friend class Reader;
+    friend class Writer;
+    friend class ChunkParser;
+    friend class ChunkWriter;
+};
+
+// One field of an array of objects stored as contiguous typed buffers.
+// The type is inferred from the first non-null value; longs widen to
+// doubles if a double appears later. Validity and bool values are bit
+// packed, least significant bit first, one bit per row. Strings are
+// dictionary encoded: codes[row] indexes into dictionary.
+struct Column
+{
+    enum Type
+    {
+        Null,
+        Bool,
+        Long,
+        Double,
+        String
+    };
+
+    std::string name;
+    Type type = Null;
+    size_t length = 0;
+    size_t nulls = 0;
+    std::vector<uint8_t> validity;
+    std::vector<uint8_t> bools;
+    std::vector<long long> longs;
+    std::vector<double> doubles;
+    std::vector<uint32_t> codes;
+    std::vector<std::string> dictionary;
+
+    bool isValid(size_t row) const
+    {
+        return validity[row >> 3] >> (row & 7) & 1;
+    }
+
+    bool getBool(size_t row) const
+    {
+        return bools[row >> 3] >> (row & 7) & 1;
+    }
+
+    const std::string& getString(size_t row) const
+    {
+        return dictionary[codes[row]];
+    }
+};
+
+struct Columns
+{
+    size_t rows = 0;
+    std::vector<Column> columns;
+
+    const Column* find(const std::string&) const;
+};
+
+Columns toColumns(const Json&, const std::vector<std::string>&);
+Json::Status parseColumns(const std::string&,
+                          const std::vector<std::string>&,
+                          Columns&);
+
+// Counters for the documents parsed and serialized on one thread. They
+// are only collected when json.cpp is compiled with JTJSON_STATS and a
+// Stats object has been installed with setStats(). Otherwise every hook
+// compiles away and statsEnabled() returns false.
+struct Stats
+{
+    // Json::parse()
+    uint64_t documents = 0;
+    uint64_t bytesParsed = 0;
+    uint64_t nulls = 0;
+    uint64_t bools = 0;
+    uint64_t longs = 0;
+    uint64_t doubles = 0;
+    uint64_t strings = 0; // including keys
+    uint64_t keys = 0;
+    uint64_t arrays = 0;
+    uint64_t objects = 0;
+    uint64_t escapesDecoded = 0;
+    uint64_t utf8Sequences = 0;
+    uint64_t longOverflows = 0; // integers past long long, rescanned as double
+    int maxDepth = 0;
+
+    // Json::toString() and Json::toStringPretty()
+    uint64_t documentsWritten = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t escapesEncoded = 0;
+    uint64_t doublesFormatted = 0;
+
+    Json toJson() const;
+};
+
+bool statsEnabled();
+Stats* setStats(Stats*);
+
+// Per-expression cost of JSONPath queries on one thread. Once a profiler
+// is installed with setJsonPathProfiler(), jsonpath(), aggregateJsonpath(),
+// updateJsonpath() and deleteJsonpath() record their compile time and a
+// breakdown of every step under the expression text. Calls that take at
+// least slowQueryNanos are also handed to onSlowQuery as they finish.
+struct JsonPathProfiler
+{
+    struct Step
+    {
+        std::string selector;
+        uint64_t frontier = 0; // nodes the step was applied to
+        uint64_t maxFrontier = 0;
+        uint64_t nodesVisited = 0; // including descendants under ".."
+        uint64_t filterEvaluations = 0;
+        uint64_t matches = 0;
+        uint64_t nanos = 0;
+    };
+
+    // A single call.
+    struct Query
+    {
+        uint64_t nanos = 0;
+        uint64_t compileNanos = 0; // zero when the path was cached
+        uint64_t matches = 0;
+        std::vector<Step> steps;
+    };
+
+    // Totals across every call of one expression.
+    struct Expression
+    {
+        uint64_t evaluations = 0;
+        uint64_t compiles = 0;
+        uint64_t slowQueries = 0;
+        uint64_t nanos = 0;
+        uint64_t maxNanos = 0;
+        uint64_t compileNanos = 0;
+        uint64_t matches = 0;
+        std::vector<Step> steps;
+    };
+
+    std::map<std::string, Expression> expressions;
+    uint64_t slowQueryNanos = 0; // zero disables onSlowQuery
+    std::function<void(const std::string&, const Query&)> onSlowQuery;
+
+    Json toJson() const;
+};
+
+JsonPathProfiler* setJsonPathProfiler(JsonPathProfiler*);
+
+// Describes the shape of a document to guide representation choices:
+// node counts by type, the share of numbers among scalars, the most
+// frequent keys, distinct object shapes, the depth histogram, array and
+// string length distributions, and containers that repeat an earlier
+// identical subtree. analyzeText() reads raw text with a Reader and never
+// builds the tree.
+Json analyze(const Json&);
+std::pair<Json::Status, Json> analyzeText(const char*, size_t);
+std::pair<Json::Status, Json> analyzeText(const std::string&);
+
+// Runs the library's parallel operations. parallelFor() calls fn on
+// consecutive subranges of [begin, end), none longer than grain items,
+// and returns once all of them are done. A grain of zero picks one from
+// the range and concurrency(). If fn throws, the remaining subranges are
+// skipped and the first exception is rethrown to the caller.
+class Executor
+{
+  public:
+    virtual ~Executor() = default;
+
+    // Threads tasks may run on, counting the caller.
+    virtual size_t concurrency() const = 0;
+    virtual void parallelFor(size_t begin,
+                             size_t end,
+                             size_t grain,
+                             const std::function<void(size_t, size_t)>& fn) = 0;
+};
+
+// Fork-join pool. Every worker owns a deque: it splits its range in
+// halves, pushing one and working on the other, and idle workers steal
+// the oldest entries of other deques. Threads outside the pool share one
+// extra deque and help until their own call is finished. A pool of one
+// thread runs everything on the caller.
+class WorkStealingExecutor : public Executor
+{
+  public:
+    explicit WorkStealingExecutor(size_t threads = 0); // 0 means per core
+    ~WorkStealingExecutor() override;
+
+    size_t concurrency() const override;
+    void parallelFor(size_t begin,
+                     size_t end,
+                     size_t grain,
+                     const std::function<void(size_t, size_t)>& fn) override;
+
+  private:
+    struct State;
+    State* state_;
+
+    WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+    WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+};
+
+// The executor parallel operations use when none is passed to them.
+// Unless one is installed with setExecutor(), it is a process-wide
+// WorkStealingExecutor created on first use. Installing nullptr goes back
+// to that pool.
+Executor& defaultExecutor();
+Executor* setExecutor(Executor*);
+
+// Publishes immutable versions of a document to concurrent readers.
+// read() pins the current version with a hazard pointer and never takes
+// a lock; it only retries if a version is published between its two
+// loads. Writers are serialized. publish() installs a new document and
+// update() applies a function to a copy of the current one. A replaced
+// version is freed by a later write, or by the destructor, once no
+// Snapshot holds it. Snapshots must not outlive their SharedDocument.
+class SharedDocument
+{
+  public:
+    class Snapshot
+    {
+      public:
+        Snapshot(Snapshot&&);
+        ~Snapshot();
+
+        const Json& operator*() const;
+        const Json* operator->() const;
+        uint64_t version() const;
+
+      private:
+        friend class SharedDocument;
+        const detail::SharedVersion* version_;
+        detail::HazardRecord* record_;
+
+        Snapshot(const detail::SharedVersion*, detail::HazardRecord*);
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        Snapshot& operator=(Snapshot&&) = delete;
+    };
+
+    explicit SharedDocument(Json = Json());
+    ~SharedDocument();
+
+    Snapshot read() const;
+    uint64_t publish(Json);
+    uint64_t update(const std::function<void(Json&)>&);
+    uint64_t version() const;
+    size_t retired() const; // replaced versions not yet freed
+
+  private:
+    struct State;
+    State* state_;
+
+    SharedDocument(const SharedDocument&) = delete;
+    SharedDocument& operator=(const SharedDocument&) = delete;
+};
+
+// Streaming access used by JT_FIELDS bindings. Reader pulls tokens from
+// text and Writer appends them, so bound structs never pass through a
+// Json tree; unknown members are skipped without being built. Syntax
+// errors are recorded as a Status and stop further reads; a value of
+// the wrong type throws std::runtime_error. Reading null leaves the
+// destination untouched.
+class Reader
+{
+  public:
+    Reader(const char*, const char*);
+
+    // Kind of the next value, without consuming it. Numbers, and text
+    // that is not JSON, come back as Long; read() them to learn more.
+    Json::Type peek();
+
+    bool beginObject();
+    bool nextKey();
+    bool beginArray();
+    bool nextElement();
+
+    const std::string& key() const
+    {
+        return key_.string_value;
+    }
+
+    void read(bool&);
+    void read(double&);
+    void read(std::string&);
+    void read(Json&);
+    void readInteger(long long&, long long, long long);
+    void readUnsigned(unsigned long long&, unsigned long long);
+    void skip();
+    Json::Status finish();
+
+  private:
+    const char* p_;
+    const char* e_;
+    int depth_;
+    bool first_ = true;
+    Json::Status status_ = Json::success;
+    Json key_;
+    Json value_;
+
+    bool readValue();
+    bool enter(char);
 };
 
+class Writer
+{
+  public:
+    explicit Writer(std::string& out) : out_(out)
+    {
+    }
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    void key(const char*, size_t);
+    void write(bool);
+    void write(long long);
+    void write(unsigned long long);
+    void write(float);
+    void write(double);
+    void write(const std::string&);
+    void write(const Json&);
+
+  private:
+    std::string& out_;
+    bool first_ = true;
+
+    void separate();
+};
+
+// Parses a document that arrives in pieces. feed() takes the next chunk
+// and returns false once the outcome is known, and finish() marks the
+// end of input. Only the bytes of a string or number cut off at the end
+// of a chunk are kept between calls, so nothing buffers the whole text.
+// Results, statuses included, are the same as Json::parse() on the
+// concatenated chunks.
+class ChunkParser
+{
+  public:
+    ChunkParser();
+
+    bool feed(const char*, size_t);
+    std::pair<Json::Status, Json> finish();
+
+  private:
+    struct Frame
+    {
+        Json value;
+        Json key;
+        int depth;
+        bool wantValue;
+    };
+
+    std::vector<Frame> stack_;
+    std::string pending_; // unfinished token
+    size_t scanned_ = 0;
+    bool escape_ = false;
+    bool eof_ = false;
+    bool done_ = false;
+    bool trailing_ = false;
+    int context_ = 0;
+    int depth_;
+    Json::Status status_ = Json::success;
+    Json root_;
+
+    const char* process(const char*, const char*);
+    const char* scanString(const char*, const char*);
+    const char* scanWord(const char*, const char*);
+    void call(int, int);
+    void complete(Json::Status, Json&);
+    void fail(Json::Status);
+};
+
+// Serializes a document in pieces. Each write() appends output until at
+// least the given number of bytes were added or the document ends, and
+// returns false once everything was written. The concatenated pieces are
+// the same as toString(), or toStringPretty() when pretty is set. The
+// document must not change until the last piece is out.
+class ChunkWriter
+{
+  public:
+    explicit ChunkWriter(const Json&, bool = false);
+
+    bool write(std::string&, size_t);
+
+  private:
+    struct Frame
+    {
+        const Json* json;
+        size_t index;
+        std::map<std::string, Json>::const_iterator key;
+        int indent;
+    };
+
+    std::vector<Frame> stack_;
+    const Json* next_;
+    int indent_ = 0;
+    bool pretty_;
+};
+
+void read(Reader&, bool&);
+void read(Reader&, float&);
+void read(Reader&, double&);
+void read(Reader&, std::string&);
+void read(Reader&, Json&);
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+read(Reader&, T&);
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value &&
+                        !std::is_same<T, bool>::value>::type
+read(Reader&, T&);
+template <typename T>
+void read(Reader&, std::vector<T>&);
+template <typename T>
+auto read(Reader& r, T& value) -> decltype(jtReadField(r, value, r.key()), void());
+
+void write(Writer&, bool);
+void write(Writer&, float);
+void write(Writer&, double);
+void write(Writer&, const std::string&);
+void write(Writer&, const char*);
+void write(Writer&, const Json&);
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+write(Writer&, T);
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value &&
+                        !std::is_same<T, bool>::value>::type
+write(Writer&, T);
+template <typename T>
+void write(Writer&, const std::vector<T>&);
+template <typename T>
+auto write(Writer& w, const T& value) -> decltype(jtWriteFields(w, value), void());
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+read(Reader& r, T& value)
+{
+    long long x = value;
+    r.readInteger(x, std::numeric_limits<T>::min(), std::numeric_limits<T>::max());
+    value = static_cast<T>(x);
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value &&
+                        !std::is_same<T, bool>::value>::type
+read(Reader& r, T& value)
+{
+    unsigned long long x = value;
+    r.readUnsigned(x, std::numeric_limits<T>::max());
+    value = static_cast<T>(x);
+}
+
+template <typename T>
+void
+read(Reader& r, std::vector<T>& value)
+{
+    if (!r.beginArray())
+        return;
+    value.clear();
+    while (r.nextElement()) {
+        // Not value.back(), which is a proxy for std::vector<bool>.
+        T element = T();
+        read(r, element);
+        value.push_back(std::move(element));
+    }
+}
+
+template <typename T>
+auto
+read(Reader& r, T& value) -> decltype(jtReadField(r, value, r.key()), void())
+{
+    if (!r.beginObject())
+        return;
+    while (r.nextKey())
+        if (!jtReadField(r, value, r.key()))
+            r.skip();
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+write(Writer& w, T value)
+{
+    w.write(static_cast<long long>(value));
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value &&
+                        !std::is_same<T, bool>::value>::type
+write(Writer& w, T value)
+{
+    w.write(static_cast<unsigned long long>(value));
+}
+
+template <typename T>
+void
+write(Writer& w, const std::vector<T>& value)
+{
+    w.beginArray();
+    for (const T& item : value)
+        write(w, item);
+    w.endArray();
+}
+
+template <typename T>
+auto
+write(Writer& w, const T& value) -> decltype(jtWriteFields(w, value), void())
+{
+    w.beginObject();
+    jtWriteFields(w, value);
+    w.endObject();
+}
+
+template <typename T>
+Json::Status
+parseInto(const std::string& text, T& value)
+{
+    Reader r(text.data(), text.data() + text.size());
+    read(r, value);
+    return r.finish();
+}
+
+template <typename T>
+std::string
+toJsonString(const T& value)
+{
+    std::string out;
+    Writer w(out);
+    write(w, value);
+    return out;
+}
+
 } // namespace jt
+
+// Binds a struct's members to JSON object keys for jt::parseInto() and
+// jt::toJsonString(). Use at namespace scope next to the struct:
+//
+//     struct Order { long long id; double total; std::vector<Item> items; };
+//     JT_FIELDS(Order, id, total, items)
+//
+// Keys are matched by length first, then by memcmp against the member
+// name. Unknown keys are skipped and missing keys keep their value.
+#define JT_FIELDS(Type, ...) \
+    inline bool jtReadField(::jt::Reader& jt_reader, \
+                            Type& jt_value, \
+                            const std::string& jt_key) \
+    { \
+        const char* jt_k = jt_key.data(); \
+        size_t jt_n = jt_key.size(); \
+        JT_EACH_(JT_READ_FIELD_, __VA_ARGS__) \
+        return false; \
+    } \
+    inline void jtWriteFields(::jt::Writer& jt_writer, const Type& jt_value) \
+    { \
+        JT_EACH_(JT_WRITE_FIELD_, __VA_ARGS__) \
+    }
+
+#define JT_READ_FIELD_(f) \
+    if (jt_n == sizeof(#f) - 1 && !std::memcmp(jt_k, #f, sizeof(#f) - 1)) { \
+        ::jt::read(jt_reader, jt_value.f); \
+        return true; \
+    }
+
+#define JT_WRITE_FIELD_(f) \
+    jt_writer.key("\"" #f "\":", sizeof(#f) + 2); \
+    ::jt::write(jt_writer, jt_value.f);
+
+#define JT_COUNT_N_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, \
+    _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, \
+    _28, _29, _30, _31, _32, N, ...) N
+#define JT_COUNT_(...) \
+    JT_COUNT_N_(__VA_ARGS__, 32, 31, 30, 29, 28, \
+    27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, \
+    9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define JT_CAT_(a, b) JT_CAT2_(a, b)
+#define JT_CAT2_(a, b) a##b
+#define JT_EACH_(M, ...) \
+    JT_CAT_(JT_EACH_, JT_COUNT_(__VA_ARGS__))(M, __VA_ARGS__)
+#define JT_EACH_1(M, a) M(a)
+#define JT_EACH_2(M, a, ...) M(a) JT_EACH_1(M, __VA_ARGS__)
+#define JT_EACH_3(M, a, ...) M(a) JT_EACH_2(M, __VA_ARGS__)
+#define JT_EACH_4(M, a, ...) M(a) JT_EACH_3(M, __VA_ARGS__)
+#define JT_EACH_5(M, a, ...) M(a) JT_EACH_4(M, __VA_ARGS__)
+#define JT_EACH_6(M, a, ...) M(a) JT_EACH_5(M, __VA_ARGS__)
+#define JT_EACH_7(M, a, ...) M(a) JT_EACH_6(M, __VA_ARGS__)
+#define JT_EACH_8(M, a, ...) M(a) JT_EACH_7(M, __VA_ARGS__)
+#define JT_EACH_9(M, a, ...) M(a) JT_EACH_8(M, __VA_ARGS__)
+#define JT_EACH_10(M, a, ...) M(a) JT_EACH_9(M, __VA_ARGS__)
+#define JT_EACH_11(M, a, ...) M(a) JT_EACH_10(M, __VA_ARGS__)
+#define JT_EACH_12(M, a, ...) M(a) JT_EACH_11(M, __VA_ARGS__)
+#define JT_EACH_13(M, a, ...) M(a) JT_EACH_12(M, __VA_ARGS__)
+#define JT_EACH_14(M, a, ...) M(a) JT_EACH_13(M, __VA_ARGS__)
+#define JT_EACH_15(M, a, ...) M(a) JT_EACH_14(M, __VA_ARGS__)
+#define JT_EACH_16(M, a, ...) M(a) JT_EACH_15(M, __VA_ARGS__)
+#define JT_EACH_17(M, a, ...) M(a) JT_EACH_16(M, __VA_ARGS__)
+#define JT_EACH_18(M, a, ...) M(a) JT_EACH_17(M, __VA_ARGS__)
+#define JT_EACH_19(M, a, ...) M(a) JT_EACH_18(M, __VA_ARGS__)
+#define JT_EACH_20(M, a, ...) M(a) JT_EACH_19(M, __VA_ARGS__)
+#define JT_EACH_21(M, a, ...) M(a) JT_EACH_20(M, __VA_ARGS__)
+#define JT_EACH_22(M, a, ...) M(a) JT_EACH_21(M, __VA_ARGS__)
+#define JT_EACH_23(M, a, ...) M(a) JT_EACH_22(M, __VA_ARGS__)
+#define JT_EACH_24(M, a, ...) M(a) JT_EACH_23(M, __VA_ARGS__)
+#define JT_EACH_25(M, a, ...) M(a) JT_EACH_24(M, __VA_ARGS__)
+#define JT_EACH_26(M, a, ...) M(a) JT_EACH_25(M, __VA_ARGS__)
+#define JT_EACH_27(M, a, ...) M(a) JT_EACH_26(M, __VA_ARGS__)
+#define JT_EACH_28(M, a, ...) M(a) JT_EACH_27(M, __VA_ARGS__)
+#define JT_EACH_29(M, a, ...) M(a) JT_EACH_28(M, __VA_ARGS__)
+#define JT_EACH_30(M, a, ...) M(a) JT_EACH_29(M, __VA_ARGS__)
+#define JT_EACH_31(M, a, ...) M(a) JT_EACH_30(M, __VA_ARGS__)
+#define JT_EACH_32(M, a, ...) M(a) JT_EACH_31(M, __VA_ARGS__)
@@ -0,0 +1,195 @@
+// -*- mode:c++;indent-tabs-mode:nil;c-basic-offset:4;coding:utf-8 -*-
+// vi: set et ft=cpp ts=4 sts=4 sw=4 fenc=utf-8 :vi
+//
+// Copyright 2024 Mozilla Foundation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Coroutine parsing and writing on top of jt::ChunkParser and
+// jt::ChunkWriter. Needs C++20; the library itself doesn't.
+
+#pragma once
+#include "json.h"
+
+#if !defined(__cpp_impl_coroutine)
+#error "json_async.h needs C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+
+namespace jt {
+
+// A coroutine started lazily. Another coroutine runs it with co_await
+// and is resumed when it finishes. Code that isn't a coroutine calls
+// start() instead, drives whatever the task awaits, and collects
+// result() once done(). A task must outlive its coroutine.
+template <typename T>
+class Task
+{
+  public:
+    struct promise_type
+    {
+        T value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+
+        struct Final
+        {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                return h.promise().continuation;
+            }
+
+            void await_resume() noexcept
+            {
+            }
+        };
+
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        Final final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_value(T x)
+        {
+            value = std::move(x);
+        }
+
+        void unhandled_exception()
+        {
+            error = std::current_exception();
+        }
+    };
+
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr))
+    {
+    }
+
+    ~Task()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        handle_.promise().continuation = caller;
+        return handle_;
+    }
+
+    T await_resume()
+    {
+        return result();
+    }
+
+    void start()
+    {
+        handle_.resume();
+    }
+
+    bool done() const
+    {
+        return handle_.done();
+    }
+
+    T result()
+    {
+        if (handle_.promise().error)
+            std::rethrow_exception(handle_.promise().error);
+        return std::move(handle_.promise().value);
+    }
+
+  private:
+    std::coroutine_handle<promise_type> handle_;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : handle_(h)
+    {
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task& operator=(Task&&) = delete;
+};
+
+// Parses the document read from source, which needs a member
+//
+//     read(char* data, size_t size)
+//
+// returning an awaitable that stores up to size bytes at data and
+// resumes with how many it stored, zero meaning the end of input. No
+// more is read once the result is known. Memory is one buffer of size
+// bytes, the tree and any string or number cut off by a read.
+template <typename Source>
+Task<std::pair<Json::Status, Json>>
+parseAsync(Source& source, size_t size = 65536)
+{
+    ChunkParser parser;
+    std::unique_ptr<char[]> buffer(new char[size]);
+    for (;;) {
+        size_t got = co_await source.read(buffer.get(), size);
+        if (!got || !parser.feed(buffer.get(), got))
+            break;
+    }
+    co_return parser.finish();
+}
+
+// Serializes json into sink, which needs a member
+//
+//     write(const char* data, size_t size)
+//
+// returning an awaitable that resumes once the sink has taken the
+// bytes, which stay valid until then. Pieces are about size bytes, and
+// only a string longer than that makes one bigger. Returns the number
+// of bytes written. json must not change before the task finishes.
+template <typename Sink>
+Task<size_t>
+writeAsync(Sink& sink, const Json& json, bool pretty = false, size_t size = 65536)
+{
+    ChunkWriter writer(json, pretty);
+    std::string piece;
+    size_t written = 0;
+    for (bool more = true; more;) {
+        piece.clear();
+        more = writer.write(piece, size);
+        if (!piece.empty()) {
+            co_await sink.write(piece.data(), piece.size());
+            written += piece.size();
+        }
+    }
+    co_return written;
+}
+
+} // namespace jt
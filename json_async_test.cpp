@@ -0,0 +1,205 @@
+// -*- mode:c++;indent-tabs-mode:nil;c-basic-offset:4;coding:utf-8 -*-
+// vi: set et ft=cpp ts=4 sts=4 sw=4 fenc=utf-8 :vi
+//
+// Copyright 2024 Mozilla Foundation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "json_async.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+using jt::Json;
+
+// Stands in for an I/O reactor. Every read and write suspends, and run()
+// resumes the waiting coroutines one at a time on this thread.
+struct Reactor
+{
+    std::deque<std::coroutine_handle<>> ready;
+    size_t suspensions = 0;
+
+    void run()
+    {
+        while (!ready.empty()) {
+            std::coroutine_handle<> h = ready.front();
+            ready.pop_front();
+            h.resume();
+        }
+    }
+};
+
+struct Pending
+{
+    Reactor& reactor;
+    size_t value;
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        ++reactor.suspensions;
+        reactor.ready.push_back(h);
+    }
+
+    size_t await_resume()
+    {
+        return value;
+    }
+};
+
+struct StringSource
+{
+    Reactor& reactor;
+    std::string text;
+    size_t step;
+    size_t pos = 0;
+    size_t reads = 0;
+    bool fail = false;
+
+    Pending read(char* data, size_t size)
+    {
+        ++reads;
+        if (fail)
+            throw std::runtime_error("connection reset");
+        size_t n = std::min(std::min(size, step), text.size() - pos);
+        memcpy(data, text.data() + pos, n);
+        pos += n;
+        return Pending{ reactor, n };
+    }
+};
+
+struct StringSink
+{
+    Reactor& reactor;
+    std::string out;
+    size_t writes = 0;
+
+    explicit StringSink(Reactor& r) : reactor(r)
+    {
+    }
+
+    Pending write(const char* data, size_t size)
+    {
+        ++writes;
+        out.append(data, size);
+        return Pending{ reactor, size };
+    }
+};
+
+template <typename T>
+T
+run(Reactor& reactor, jt::Task<T>& task)
+{
+    task.start();
+    reactor.run();
+    if (!task.done())
+        exit(1);
+    return task.result();
+}
+
+void
+parse_async_test()
+{
+    static const char* const kDocs[] = {
+        R"({"a":[1,2.5e3,{"b":"cé\n"}],"d":true,"e":null})",
+        "[1,2,3] x",
+        "[\"abc",
+        "{\"a\" 1}",
+        "  ",
+        "-12.75 ",
+    };
+    for (const char* doc : kDocs) {
+        std::pair<Json::Status, Json> expect = Json::parse(doc);
+        for (size_t step = 1; step < 8; ++step) {
+            Reactor reactor;
+            StringSource source{ reactor, doc, step };
+            jt::Task<std::pair<Json::Status, Json>> task = jt::parseAsync(source, 4);
+            std::pair<Json::Status, Json> got = run(reactor, task);
+            if (got.first != expect.first || got.second.toString() != expect.second.toString())
+                exit(2);
+            if (reactor.suspensions != source.reads)
+                exit(3);
+        }
+    }
+    Reactor reactor;
+    StringSource source{ reactor, "[1,}" + std::string(1000, ' '), 2 };
+    jt::Task<std::pair<Json::Status, Json>> task = jt::parseAsync(source, 2);
+    if (run(reactor, task).first != Json::unexpected_end_of_object || source.reads != 2)
+        exit(4);
+}
+
+void
+write_async_test()
+{
+    Json json = Json::parse(R"({"a":[1,2.5,{"b":"c"}],"d":{"e":[]},"f":"g"})").second;
+    for (int pretty = 0; pretty < 2; ++pretty) {
+        std::string expect = pretty ? json.toStringPretty() : json.toString();
+        Reactor reactor;
+        StringSink sink{ reactor };
+        jt::Task<size_t> task = jt::writeAsync(sink, json, pretty, 8);
+        if (run(reactor, task) != expect.size() || sink.out != expect)
+            exit(5);
+        if (sink.writes < expect.size() / 16 || reactor.suspensions != sink.writes)
+            exit(6);
+    }
+}
+
+jt::Task<size_t>
+echo(StringSource& source, StringSink& sink)
+{
+    std::pair<Json::Status, Json> doc = co_await jt::parseAsync(source, 3);
+    if (doc.first != Json::success)
+        co_return 0;
+    co_return co_await jt::writeAsync(sink, doc.second, false, 5);
+}
+
+void
+compose_test()
+{
+    Reactor reactor;
+    StringSource source{ reactor, R"([ {"id": 1, "tags": ["x", "y"]}, {"id": 2} ])", 3 };
+    StringSink sink{ reactor };
+    jt::Task<size_t> task = echo(source, sink);
+    if (!run(reactor, task) || sink.out != R"([{"id":1,"tags":["x","y"]},{"id":2}])")
+        exit(7);
+}
+
+void
+exception_test()
+{
+    Reactor reactor;
+    StringSource source{ reactor, "[1,2", 1 };
+    source.fail = true;
+    jt::Task<std::pair<Json::Status, Json>> task = jt::parseAsync(source);
+    try {
+        run(reactor, task);
+        exit(8);
+    } catch (const std::runtime_error&) {
+    }
+}
+
+int
+main()
+{
+    parse_async_test();
+    write_async_test();
+    compose_test();
+    exception_test();
+}
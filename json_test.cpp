@@ -20,12 +20,16 @@
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <stdexcept>
+#include <thread>
 
 #define ARRAYLEN(A) \
     ((sizeof(A) / sizeof(*(A))) / ((unsigned)!(sizeof(A) % sizeof(*(A)))))
 
 #define STRING(sl) std::string(sl, sizeof(sl) - 1)
 
+using jt::Column;
+using jt::Columns;
 using jt::Json;
 
 static const char kHuge[] = R"([
@@ -189,6 +193,17 @@ parse_test()
   "b": [2, 3]
 })")
         exit(7);
+    // Only the given bytes are read, so the text need not end in a NUL.
+    const char buffer[] = "[1,2]]garbage";
+    res = Json::parse(buffer, 5);
+    if (res.first != Json::success || res.second.toString() != "[1,2]")
+        exit(160);
+    res = Json::parse(buffer, 6);
+    if (res.first != Json::trailing_content)
+        exit(161);
+    res = Json::parse(buffer, 4);
+    if (res.first == Json::success)
+        exit(162);
 }
 
 
@@ -416,6 +431,647 @@ jsonpath_complex_perf_test()
         exit(233);
 }
 
+void
+jsonpath_filter_planner_test()
+{
+    auto parsed = Json::parse(kLargeJsonExample);
+    if (parsed.first != Json::success)
+        exit(110);
+    const Json& json = parsed.second;
+
+    // Operands written expensive-first must select the same nodes once
+    // the planner moves the cheap test to the front.
+    auto a = json.jsonpath("$.store.book[?(@.author =~ 'M.*' && @.isbn)].title");
+    if (a.size() != 1 || a[0]->getString() != "Moby Dick")
+        exit(111);
+    auto b = json.jsonpath("$.store.book[?(@.isbn && @.author =~ 'M.*')].title");
+    if (b.size() != 1 || b[0] != a[0])
+        exit(112);
+
+    // Mixed chains keep && binding tighter than ||.
+    auto c = json.jsonpath(
+      "$.store.book[?(@.price > 20 || @.category == 'reference' && @.price < 10)]");
+    if (c.size() != 2)
+        exit(113);
+
+    // Subtrees that never look at '@' are evaluated once per step.
+    auto d = json.jsonpath("$.store.book[?($.expensive > 5 && @.price < 10)]");
+    if (d.size() != 4)
+        exit(114);
+    auto e = json.jsonpath("$.store.book[?($.expensive > 50 || !@.isbn)]");
+    if (e.size() != 6)
+        exit(115);
+    auto f = json.jsonpath("$.store.book[?($.expensive > 50)]");
+    if (!f.empty())
+        exit(116);
+    auto g = json.jsonpath("$.store.book[?(!($..bicycle.color == 'red'))]");
+    if (!g.empty())
+        exit(117);
+}
+
+void
+jsonpath_invariant_operand_test()
+{
+    auto parsed = Json::parse(kLargeJsonExample);
+    if (parsed.first != Json::success)
+        exit(120);
+    Json& json = parsed.second;
+
+    // $.expensive is resolved once per step, not once per book.
+    auto a = json.jsonpath("$.store.book[?(@.price < $.expensive)].title");
+    if (a.size() != 4 || a[0]->getString() != "Sayings of the Century")
+        exit(121);
+    auto b = json.jsonpath("$.store.book[?($.expensive >= @.price)]");
+    if (b.size() != 4)
+        exit(122);
+
+    // Invariant arguments inside functions are cached as well.
+    auto c = json.jsonpath("$.store.book[?(@.price > length($.store.book))]");
+    if (c.size() != 7)
+        exit(123);
+
+    // The cache lives for one step invocation, so a path that runs the
+    // same filter under several parents sees fresh values each time.
+    auto d = json.jsonpath("$..[?(@.price > $.store.bicycle.price)]");
+    if (d.size() != 5)
+        exit(124);
+
+    // Mutations between queries are observed.
+    json["expensive"] = 9;
+    auto e = json.jsonpath("$.store.book[?(@.price < $.expensive)]");
+    if (e.size() != 3)
+        exit(125);
+}
+
+void
+jsonpath_aggregate_test()
+{
+    auto parsed = Json::parse(R"({
+      "orders": [
+        {"id": 1, "items": [{"price": 2}, {"price": 3}], "tags": ["a", "b"]},
+        {"id": 2, "items": [{"price": 1.5}], "tags": ["b", "c"]},
+        {"id": 3, "items": [], "tags": []}
+      ],
+      "totals": [4, 1, 7, 1.0, 3]
+    })");
+    if (parsed.first != Json::success)
+        exit(130);
+    const Json& json = parsed.second;
+
+    // Integer sums stay integral; mixing in a double promotes the result.
+    Json a = json.aggregateJsonpath("$.orders[0].items[*].price.sum()");
+    if (!a.isLong() || a.getLong() != 5)
+        exit(131);
+    Json b = json.aggregateJsonpath("$..price.sum()");
+    if (!b.isDouble() || b.getDouble() != 6.5)
+        exit(132);
+
+    // An array match contributes its elements.
+    if (json.aggregateJsonpath("$.totals.min()").getNumber() != 1 ||
+        json.aggregateJsonpath("$.totals.max()").getLong() != 7 ||
+        json.aggregateJsonpath("$.totals.avg()").getDouble() != 3.2)
+        exit(133);
+    Json d = json.aggregateJsonpath("$.totals.distinct()");
+    if (d.toString() != "[4,1,7,3]")
+        exit(134);
+    if (json.aggregateJsonpath("$.orders[*].tags.distinct()").toString() !=
+        "[\"a\",\"b\",\"c\"]")
+        exit(135);
+    Json big = Json::parse("[1152921504606846976, 1.152921504606846976e18, 9007199254740993]").second;
+    if (big.aggregateJsonpath("$.distinct()").getArray().size() != 2)
+        exit(126);
+
+    // Empty inputs.
+    if (json.aggregateJsonpath("$.orders[2].items[*].price.sum()").getLong() != 0 ||
+        !json.aggregateJsonpath("$.missing.avg()").isNull() ||
+        !json.aggregateJsonpath("$.missing.max()").isNull())
+        exit(136);
+
+    // Aggregates inside filters, in both spellings.
+    auto e = json.jsonpath("$.orders[?(sum(@.items[*].price) > 2)].id");
+    if (e.size() != 1 || e[0]->getLong() != 1)
+        exit(137);
+    auto f = json.jsonpath("$.orders[?(@.items[*].price.max() < 2)].id");
+    if (f.size() != 1 || f[0]->getLong() != 2)
+        exit(138);
+
+    // Plain queries reject a trailing aggregate.
+    try {
+        json.jsonpath("$.totals.sum()");
+        exit(139);
+    } catch (const std::runtime_error&) {
+    }
+}
+
+void
+columns_test()
+{
+    static const char kRecords[] = R"([
+      {"id": 1, "name": "ann", "score": 2, "ok": true},
+      {"id": 2, "name": "bob", "score": 2.5, "extra": [1, 2]},
+      {"id": 3, "name": "ann", "score": null, "ok": false}
+    ])";
+    const std::vector<std::string> fields = { "id", "name", "score", "ok", "nope" };
+
+    Columns a = jt::toColumns(Json::parse(kRecords).second, fields);
+    if (a.rows != 3 || a.columns.size() != 5)
+        exit(140);
+    const Column* id = a.find("id");
+    if (!id || id->type != Column::Long || id->longs[2] != 3 || id->nulls)
+        exit(141);
+    const Column* name = a.find("name");
+    if (name->type != Column::String || name->dictionary.size() != 2 ||
+        name->codes[0] != name->codes[2] || name->getString(1) != "bob")
+        exit(142);
+
+    // A double after a long widens the column; null keeps its slot.
+    const Column* score = a.find("score");
+    if (score->type != Column::Double || score->doubles.size() != 3 ||
+        score->doubles[0] != 2 || score->doubles[1] != 2.5 ||
+        score->isValid(2) || score->nulls != 1)
+        exit(143);
+    const Column* ok = a.find("ok");
+    if (ok->type != Column::Bool || !ok->getBool(0) || ok->isValid(1) ||
+        !ok->isValid(2) || ok->getBool(2))
+        exit(144);
+    const Column* nope = a.find("nope");
+    if (nope->type != Column::Null || nope->nulls != 3)
+        exit(145);
+
+    // Parsing straight from text gives the same columns for both layouts.
+    Columns b, c;
+    std::string ndjson = "{\"id\": 1, \"name\": \"ann\", \"score\": 2, \"ok\": true}\n"
+                         "{\"id\": 2, \"name\": \"bob\", \"score\": 2.5}\n"
+                         "{\"score\": null, \"id\": 3, \"ok\": false, \"name\": \"ann\"}\n";
+    if (jt::parseColumns(kRecords, fields, b) != Json::success ||
+        jt::parseColumns(ndjson, fields, c) != Json::success)
+        exit(146);
+    for (const Columns* x : { &b, &c }) {
+        if (x->rows != 3)
+            exit(147);
+        for (size_t i = 0; i < fields.size(); ++i) {
+            const Column& l = a.columns[i];
+            const Column& r = x->columns[i];
+            if (l.type != r.type || l.validity != r.validity ||
+                l.longs != r.longs || l.doubles != r.doubles ||
+                l.bools != r.bools || l.codes != r.codes ||
+                l.dictionary != r.dictionary)
+                exit(148);
+        }
+    }
+
+    // Syntax errors surface as parse statuses.
+    if (jt::parseColumns("[{\"id\": 1},]", fields, b) != Json::unexpected_end_of_array ||
+        jt::parseColumns("[{\"id\": 1}", fields, b) != Json::unexpected_eof ||
+        jt::parseColumns("{\"id\" 1}", fields, b) != Json::missing_colon)
+        exit(149);
+
+    // So do records that aren't objects or don't start a line.
+    if (jt::parseColumns("[1,2]", fields, b) != Json::record_must_be_object ||
+        jt::parseColumns("{\"id\": 1}\n[2]\n", fields, b) != Json::record_must_be_object ||
+        jt::parseColumns("{\"id\": 1} {\"id\": 2}", fields, b) != Json::trailing_content ||
+        jt::parseColumns("{\"id\": 1} \r\n{\"id\": 2}", fields, b) != Json::success ||
+        b.rows != 2)
+        exit(247);
+
+    // Fields outside the projection are skipped but still checked.
+    if (jt::parseColumns(R"({"id": 7, "x": {"a": [1, {"b": "q\"}"}]}, "y": [[]]})", fields, b) !=
+          Json::success ||
+        b.rows != 1 || b.columns[0].longs[0] != 7)
+        exit(118);
+    if (jt::parseColumns("{\"id\": 1, \"x\": [1 2]}", fields, b) != Json::missing_comma ||
+        jt::parseColumns("{\"id\": 1, \"x\": {\"a\" 1}}", fields, b) != Json::missing_colon ||
+        jt::parseColumns("{\"id\": 1, \"x\": {5: 1}}", fields, b) != Json::object_key_must_be_string ||
+        jt::parseColumns("{\"id\": 1, 5: 1}", fields, b) != Json::object_key_must_be_string ||
+        jt::parseColumns("{\"x\": [1, 01]}", fields, b) != Json::unexpected_octal)
+        exit(119);
+}
+
+struct BoundItem
+{
+    std::string sku;
+    int quantity = 0;
+    double price = 0;
+};
+JT_FIELDS(BoundItem, sku, quantity, price)
+
+struct BoundOrder
+{
+    long long id = 0;
+    bool paid = false;
+    unsigned short region = 0;
+    std::vector<BoundItem> items;
+    std::vector<std::string> tags;
+    std::vector<bool> flags;
+    Json extra;
+};
+JT_FIELDS(BoundOrder, id, paid, region, items, tags, flags, extra)
+
+void
+struct_binding_test()
+{
+    BoundOrder order;
+    order.region = 7;
+    Json::Status status = jt::parseInto(R"({
+      "id": 42, "paid": true, "ignored": {"deep": [1, 2, {"x": null}]},
+      "items": [{"sku": "aé", "quantity": 2, "price": 9.5},
+                {"price": 3, "sku": "b"}],
+      "tags": ["x", "y"], "region": null, "extra": {"k": [true]},
+      "flags": [true, false, true]
+    })",
+                                        order);
+    if (status != Json::success)
+        exit(150);
+    if (order.id != 42 || !order.paid || order.region != 7 || order.tags.size() != 2)
+        exit(151);
+    if (order.items.size() != 2 || order.items[0].sku != "a\xc3\xa9" ||
+        order.items[0].quantity != 2 || order.items[1].price != 3 ||
+        order.items[1].quantity != 0)
+        exit(152);
+    if (order.extra.toString() != "{\"k\":[true]}")
+        exit(153);
+    if (order.flags.size() != 3 || !order.flags[0] || order.flags[1] || !order.flags[2])
+        exit(127);
+
+    // The generated writer emits members in declaration order.
+    std::string text = jt::toJsonString(order);
+    if (text != "{\"id\":42,\"paid\":true,\"region\":7,\"items\":"
+                "[{\"sku\":\"a\\u00e9\",\"quantity\":2,\"price\":9.5},"
+                "{\"sku\":\"b\",\"quantity\":0,\"price\":3}],"
+                "\"tags\":[\"x\",\"y\"],\"flags\":[true,false,true],"
+                "\"extra\":{\"k\":[true]}}")
+        exit(154);
+    BoundOrder copy;
+    if (jt::parseInto(text, copy) != Json::success || jt::toJsonString(copy) != text)
+        exit(155);
+
+    // Syntax errors come back as the same statuses Json::parse reports.
+    if (jt::parseInto("{\"id\": 1,}", copy) != Json::unexpected_end_of_object ||
+        jt::parseInto("{\"items\": [{}, ]}", copy) != Json::unexpected_end_of_array ||
+        jt::parseInto("{\"id\": 1} x", copy) != Json::trailing_content ||
+        jt::parseInto("{\"id\": 1", copy) != Json::unexpected_eof)
+        exit(156);
+
+    // Unknown members and mismatched containers are skipped, not built,
+    // but their syntax is still checked.
+    if (jt::parseInto("{\"nope\": [1 2]}", copy) != Json::missing_comma ||
+        jt::parseInto("{\"nope\": {\"a\": \"\\q\"}}", copy) != Json::invalid_escape_character ||
+        jt::parseInto("{\"id\": [1 2]}", copy) != Json::missing_comma)
+        exit(128);
+    try {
+        jt::parseInto("{\"id\": [1, 2]}", copy);
+        exit(129);
+    } catch (const std::runtime_error&) {
+    }
+
+    // Values of the wrong type or range throw.
+    try {
+        jt::parseInto("{\"id\": \"42\"}", copy);
+        exit(157);
+    } catch (const std::runtime_error&) {
+    }
+    try {
+        jt::parseInto("{\"region\": 70000}", copy);
+        exit(158);
+    } catch (const std::runtime_error&) {
+    }
+    try {
+        jt::parseInto("{\"items\": {}}", copy);
+        exit(159);
+    } catch (const std::runtime_error&) {
+    }
+}
+
+void
+stats_test()
+{
+    jt::Stats stats;
+    jt::Stats* previous = jt::setStats(&stats);
+    std::pair<Json::Status, Json> res = Json::parse(
+      R"({"a":[1,2.5,null,true,"\né"],"b":{"c":99999999999999999999}})");
+    if (res.first != Json::success)
+        exit(163);
+    std::string out = res.second.toString();
+    if (jt::setStats(previous) != (jt::statsEnabled() ? &stats : nullptr))
+        exit(164);
+    if (!jt::statsEnabled()) {
+        if (stats.documents || stats.bytesWritten)
+            exit(165);
+        return;
+    }
+    if (stats.documents != 1 || stats.objects != 2 || stats.arrays != 1 ||
+        stats.keys != 3 || stats.strings != 4 || stats.longs != 1 ||
+        stats.doubles != 2 || stats.nulls != 1 || stats.bools != 1)
+        exit(166);
+    if (stats.escapesDecoded != 1 || stats.utf8Sequences != 1 ||
+        stats.longOverflows != 1 || stats.maxDepth != 2)
+        exit(167);
+    if (stats.documentsWritten != 1 || stats.bytesWritten != out.size() ||
+        stats.doublesFormatted != 2 || stats.escapesEncoded != 2)
+        exit(168);
+    if (stats.toJson()["keys"].getLong() != 3)
+        exit(169);
+    Json::parse("[1]");
+    if (stats.documents != 1)
+        exit(170);
+}
+
+void
+jsonpath_profiler_test()
+{
+    const std::string expr = "$.store..book[?(@.price<10)].title";
+    Json doc = Json::parse(R"({"store":{"book":[{"title":"a","price":8},)"
+                           R"({"title":"b","price":12},{"title":"c","price":5}]}})")
+                 .second;
+    jt::JsonPathProfiler profiler;
+    profiler.slowQueryNanos = 1;
+    int slow = 0;
+    profiler.onSlowQuery = [&](const std::string& expression,
+                               const jt::JsonPathProfiler::Query& query) {
+        if (expression == expr && query.steps.size() == 4 &&
+            query.steps[2].filterEvaluations == 3 && query.matches == 2)
+            ++slow;
+    };
+    jt::JsonPathProfiler* previous = jt::setJsonPathProfiler(&profiler);
+    doc.jsonpath(expr);
+    doc.jsonpath(expr);
+    doc.updateJsonpath("$.store.book[1].price", Json(9));
+    Json sum = doc.aggregateJsonpath("$.store.book[*].price.sum()");
+    doc.deleteJsonpath("$.store.book[0]");
+    if (jt::setJsonPathProfiler(previous) != &profiler)
+        exit(171);
+    doc.jsonpath(expr);
+    const jt::JsonPathProfiler::Expression& entry = profiler.expressions[expr];
+    if (entry.evaluations != 2 || entry.compiles != 1 || entry.matches != 4 ||
+        entry.slowQueries != 2 || slow != 2)
+        exit(172);
+    if (entry.steps.size() != 4 || entry.steps[0].selector != ".store" ||
+        entry.steps[1].selector != "..book" || entry.steps[3].selector != ".title")
+        exit(173);
+    if (entry.steps[1].frontier != 2 || entry.steps[1].nodesVisited != 22 ||
+        entry.steps[1].matches != 2)
+        exit(174);
+    if (entry.steps[2].filterEvaluations != 6 || entry.steps[2].matches != 4 ||
+        entry.steps[2].maxFrontier != 1)
+        exit(175);
+    const jt::JsonPathProfiler::Expression& update = profiler.expressions["$.store.book[1].price"];
+    if (update.steps.size() != 4 || update.matches != 1 || update.steps[3].matches != 1)
+        exit(246);
+    if (profiler.expressions["$.store.book[1].price"].evaluations != 1 ||
+        profiler.expressions["$.store.book[*].price.sum()"].matches != 3 ||
+        sum.getLong() != 22)
+        exit(176);
+    if (profiler.expressions["$.store.book[0]"].matches != 1 ||
+        profiler.expressions.size() != 4)
+        exit(177);
+    Json report = profiler.toJson();
+    if (report[expr]["steps"][2]["filterEvaluations"].getLong() != 6)
+        exit(178);
+}
+
+void
+analyze_test()
+{
+    const std::string text = R"({"a":[1,2,3],"b":[1,2,3],"c":{"x":"hi","y":"hello"},)"
+                             R"("d":[{"y":"hello","x":"hi"}]})";
+    Json report = jt::analyze(Json::parse(text).second);
+    if (report["nodes"].getLong() != 16 || report["types"]["object"].getLong() != 3 ||
+        report["types"]["long"].getLong() != 6 || report["numericRatio"].getDouble() != 0.6)
+        exit(179);
+    if (report["keys"]["total"].getLong() != 8 || report["keys"]["distinct"].getLong() != 6 ||
+        report["keys"]["top"][0]["key"].getString() != "x" ||
+        report["keys"]["top"][0]["count"].getLong() != 2)
+        exit(180);
+    if (report["depth"]["max"].getLong() != 3 ||
+        report["depth"]["histogram"].toString() != "[1,4,9,2]")
+        exit(181);
+    if (report["arrays"]["count"].getLong() != 3 || report["arrays"]["numeric"].getLong() != 2 ||
+        report["arrays"]["lengths"]["p50"].getLong() != 3 ||
+        report["arrays"]["histogram"].toString() !=
+          R"([{"count":1,"max":1,"min":1},{"count":2,"max":3,"min":2}])")
+        exit(182);
+    if (report["strings"]["count"].getLong() != 4 ||
+        report["strings"]["lengths"]["p50"].getLong() != 2 ||
+        report["strings"]["lengths"]["max"].getLong() != 5)
+        exit(183);
+    if (report["objects"]["shapes"].getLong() != 2 ||
+        report["repeatedSubtrees"]["count"].getLong() != 2 ||
+        report["repeatedSubtrees"]["nodes"].getLong() != 7)
+        exit(184);
+    std::pair<Json::Status, Json> streamed = jt::analyzeText(text);
+    if (streamed.first != Json::success || streamed.second.toString() != report.toString())
+        exit(185);
+    if (jt::analyzeText("[1,").first != Json::unexpected_eof)
+        exit(186);
+    if (jt::analyzeText("[1] 2").first != Json::trailing_content)
+        exit(187);
+}
+
+struct CountingExecutor : jt::Executor
+{
+    int calls = 0;
+
+    size_t concurrency() const override
+    {
+        return 1;
+    }
+
+    void parallelFor(size_t begin,
+                     size_t end,
+                     size_t,
+                     const std::function<void(size_t, size_t)>& fn) override
+    {
+        ++calls;
+        fn(begin, end);
+    }
+};
+
+void
+executor_test()
+{
+    jt::WorkStealingExecutor pool(4);
+    if (pool.concurrency() != 4)
+        exit(188);
+    std::vector<int> hits(10000);
+    std::atomic<size_t> largest(0);
+    pool.parallelFor(0, hits.size(), 64, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            ++hits[i];
+        size_t seen = largest.load();
+        while (end - begin > seen && !largest.compare_exchange_weak(seen, end - begin)) {
+        }
+    });
+    for (int hit : hits)
+        if (hit != 1)
+            exit(189);
+    if (largest.load() > 64 || !largest.load())
+        exit(190);
+    std::atomic<long long> total(0);
+    pool.parallelFor(0, 100, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            pool.parallelFor(0, 100, 10, [&](size_t b, size_t e) { total += e - b; });
+    });
+    if (total.load() != 10000)
+        exit(191);
+    bool thrown = false;
+    try {
+        pool.parallelFor(0, 1000, 10, [](size_t begin, size_t) {
+            if (begin == 500)
+                throw std::runtime_error("boom");
+        });
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    if (!thrown)
+        exit(192);
+    jt::WorkStealingExecutor serial(1);
+    size_t chunks = 0;
+    serial.parallelFor(5, 105, 7, [&](size_t, size_t) { ++chunks; });
+    if (serial.concurrency() != 1 || chunks != 15)
+        exit(193);
+    CountingExecutor custom;
+    jt::Executor* previous = jt::setExecutor(&custom);
+    jt::defaultExecutor().parallelFor(0, 10, 0, [](size_t, size_t) {});
+    if (jt::setExecutor(previous) != &custom || custom.calls != 1)
+        exit(194);
+    if (&jt::defaultExecutor() == &custom || !jt::defaultExecutor().concurrency())
+        exit(195);
+}
+
+void
+parse_batch_test()
+{
+    std::vector<std::string> texts;
+    for (int i = 0; i < 1000; ++i)
+        texts.push_back(i % 7 ? "{\"id\":" + std::to_string(i) + "}" : "[1,");
+    jt::WorkStealingExecutor pool(4);
+    Json::BatchOptions options;
+    options.executor = &pool;
+    options.grain = 16;
+    std::vector<std::pair<Json::Status, Json>> results = Json::parseBatch(texts, options);
+    if (results.size() != texts.size())
+        exit(196);
+    for (size_t i = 0; i < texts.size(); ++i) {
+        std::pair<Json::Status, Json> expect = Json::parse(texts[i]);
+        if (results[i].first != expect.first || results[i].second.toString() != expect.second.toString())
+            exit(197);
+    }
+    if (results[1].second["id"].getLong() != 1 || results[7].first != Json::unexpected_eof)
+        exit(198);
+    Json::Buffer buffers[] = { { "true", 4 }, { "[2]", 3 } };
+    std::pair<Json::Status, Json> out[2];
+    Json::parseBatch(buffers, 2, out, Json::BatchOptions());
+    if (!out[0].second.getBool() || out[1].second[0].getLong() != 2 ||
+        !Json::parseBatch(std::vector<std::string>()).empty())
+        exit(199);
+}
+
+void
+shared_document_test()
+{
+    jt::SharedDocument shared(Json::parse(R"({"n":0,"copy":0})").second);
+    {
+        jt::SharedDocument::Snapshot old = shared.read();
+        if (old.version() != 1 || shared.publish(Json::parse(R"({"n":1,"copy":1})").second) != 2)
+            exit(234);
+        if (old->toString() != R"({"copy":0,"n":0})" || shared.read()->toString() != R"({"copy":1,"n":1})")
+            exit(235);
+        if (shared.retired() != 1)
+            exit(236);
+    }
+    shared.update([](Json& json) {
+        json["n"] = 2;
+        json["copy"] = 2;
+    });
+    if (shared.retired() != 0 || shared.version() != 3 || shared.read()->getObject().at("n").getLong() != 2)
+        exit(237);
+    std::atomic<bool> done(false);
+    std::atomic<int> torn(0);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; ++i) {
+        readers.emplace_back([&] {
+            while (!done.load()) {
+                jt::SharedDocument::Snapshot snap = shared.read();
+                const auto& object = snap->getObject();
+                if (object.at("n").getLong() != object.at("copy").getLong())
+                    ++torn;
+            }
+        });
+    }
+    for (int i = 0; i < 200; ++i) {
+        shared.update([](Json& json) {
+            json["n"] = json["n"].getLong() + 1;
+            json["copy"] = json["n"];
+        });
+    }
+    done = true;
+    for (std::thread& reader : readers)
+        reader.join();
+    if (torn.load() || shared.version() != 203 || shared.read()->getObject().at("copy").getLong() != 202)
+        exit(238);
+}
+
+void
+chunk_parser_test()
+{
+    static const char* const kDocs[] = {
+        "", " ", "0", "-0.5e+3 ", "01", "-", "1.", "1e", "nul", "nullnull", "truex", "[1,2]x",
+        R"("a\"b\\\u00e9\ud83d\ude00")", "\"\\u12\"", "\"abc", "\"\xc3\"",
+        R"({"a":[1,{"b":null}],"c":"d"})", "{}", "[]", "[1,]", "[,1]", "{\"a\":1,}",
+        "{\"a\" 1}", "{\"a\":}", "{1:2}", "{\"a\":1,[1]:2}", "{\"a\":1,[1 2]:2}", "[1 2]",
+        "[1:2]", "[\"a\" \"b\"]", "{\"a\":1 \"b\":2}", "]", "}", "@", "[\xef\xbb\xbf]",
+        "[[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]]", "[[[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]]]]",
+        "[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]]]]]]]]]]]", "[1, 2.25, -3e-2, true, false, null]",
+    };
+    for (const char* doc : kDocs) {
+        std::string text(doc);
+        std::pair<Json::Status, Json> expect = Json::parse(text);
+        for (size_t chunk = 1; chunk <= text.size() + 1; ++chunk) {
+            jt::ChunkParser parser;
+            for (size_t i = 0; i < text.size(); i += chunk)
+                if (!parser.feed(text.data() + i, std::min(chunk, text.size() - i)))
+                    break;
+            std::pair<Json::Status, Json> got = parser.finish();
+            if (got.first != expect.first)
+                exit(239);
+            if ((got.first == Json::success || got.first == Json::trailing_content) &&
+                got.second.toString() != expect.second.toString())
+                exit(240);
+        }
+    }
+    jt::ChunkParser parser;
+    if (parser.feed("[1,", 3) != true || parser.feed("@", 1) != false ||
+        parser.finish().first != Json::illegal_character)
+        exit(241);
+}
+
+void
+chunk_writer_test()
+{
+    Json json = Json::parse(R"({"a":[1,2.5,{"b":"c\n","d":{}}],"e":{"f":[]},"g":null})").second;
+    for (int pretty = 0; pretty < 2; ++pretty) {
+        std::string expect = pretty ? json.toStringPretty() : json.toString();
+        for (size_t size = 1; size <= expect.size(); ++size) {
+            jt::ChunkWriter writer(json, pretty);
+            std::string out;
+            size_t pieces = 0;
+            for (bool more = true; more; ++pieces) {
+                size_t before = out.size();
+                more = writer.write(out, size);
+                if (more && out.size() - before < size)
+                    exit(242);
+            }
+            if (out != expect)
+                exit(243);
+            if (size == 1 && pieces < expect.size() / 4)
+                exit(244);
+        }
+    }
+    std::string out;
+    if (jt::ChunkWriter(Json(7), false).write(out, 64) || out != "7")
+        exit(245);
+}
+
 static const struct
 {
     std::string before;
@@ -720,6 +1376,19 @@ main()
     parse_test();
     jsonpath_test();
     jsonpath_update_delete_test();
+    jsonpath_filter_planner_test();
+    jsonpath_invariant_operand_test();
+    jsonpath_aggregate_test();
+    columns_test();
+    struct_binding_test();
+    stats_test();
+    jsonpath_profiler_test();
+    analyze_test();
+    executor_test();
+    parse_batch_test();
+    shared_document_test();
+    chunk_parser_test();
+    chunk_writer_test();
     round_trip_test();
     afl_regression();
     json_test_suite();
@@ -0,0 +1,310 @@
+// -*- mode:c++;indent-tabs-mode:nil;c-basic-offset:4;coding:utf-8 -*-
+// vi: set et ft=cpp ts=4 sts=4 sw=4 fenc=utf-8 :vi
+//
+// Copyright 2024 Mozilla Foundation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Performance fuzzer. Every input is parsed, serialized and queried with
+// a fixed set of JSONPath expressions, and each operation must finish
+// within a budget linear in the input size. An input over budget aborts,
+// so libFuzzer saves it as a crash.
+//
+//     cmake -B fuzz -DCMAKE_CXX_COMPILER=clang++ -DJSON_CPP_FUZZ=ON
+//     cmake --build fuzz --target perf_fuzz
+//     fuzz/perf_fuzz -max_len=262144 fuzzies/perf
+//
+// Built without JTJSON_LIBFUZZER it runs the files and directories named
+// on its command line instead, which is how the checked in regressions
+// under fuzzies/perf are tested.
+//
+// Queries are also budgeted in the nodes their steps visit, as counted
+// by the JSONPath profiler, which is the same on every machine and
+// build. Other work is measured in user space instructions retired when
+// the kernel offers a counter and in nanoseconds otherwise. Timing is
+// noisy, so an operation over budget is measured twice more and judged
+// by its best. Nanoseconds depend on the machine and instructions on
+// sanitizers, so either one over budget is only reported, not failed,
+// unless the instructions come from a build without sanitizers.
+
+#include "json.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using jt::Json;
+
+namespace {
+
+struct Budget
+{
+    unsigned long long fixed;
+    unsigned long long perByte;
+};
+
+const Budget kVisitBudget = { 1000, 8 };
+const Budget kInstructionBudget = { 2000000, 5000 };
+const Budget kNanosecondBudget = { 5000000, 1000 };
+const int kAttempts = 3;
+
+// The build defines JTJSON_SANITIZED for any -fsanitize flag, since GCC
+// has no macro for UBSan.
+#if !defined(JTJSON_SANITIZED) && defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || \
+  __has_feature(memory_sanitizer) || __has_feature(undefined_behavior_sanitizer)
+#define JTJSON_SANITIZED 1
+#endif
+#endif
+#if !defined(JTJSON_SANITIZED) && (defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__))
+#define JTJSON_SANITIZED 1
+#endif
+
+#ifdef JTJSON_SANITIZED
+const bool kSanitized = true;
+#else
+const bool kSanitized = false;
+#endif
+
+// Each query walks the whole document, so none of them should cost more
+// than a constant amount per input byte.
+const char* const kQueries[] = {
+    "$..*",
+    "$..[*]",
+    "$..[0]",
+    "$..[-1:]",
+    "$..a",
+    "$..['a','b']",
+    "$..[?(@.a)]",
+    "$..[?(@ == 1)]",
+    "$..[?(@.length > 2)]",
+};
+
+class WorkCounter
+{
+  public:
+    WorkCounter()
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    bool instructions() const
+    {
+        return fd_ >= 0;
+    }
+
+    const char* unit() const
+    {
+        return instructions() ? "instructions" : "ns";
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+            return;
+        }
+#endif
+        started_ = std::chrono::steady_clock::now();
+    }
+
+    unsigned long long stop()
+    {
+#ifdef __linux__
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            unsigned long long count = 0;
+            if (read(fd_, &count, sizeof(count)) != sizeof(count))
+                return 0;
+            return count;
+        }
+#endif
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now() - started_)
+          .count();
+    }
+
+  private:
+    int fd_ = -1;
+    std::chrono::steady_clock::time_point started_;
+};
+
+WorkCounter&
+counter()
+{
+    static WorkCounter counter;
+    return counter;
+}
+
+// Runs op and reports when its work exceeds the budget for size bytes,
+// aborting if the count can be trusted.
+template <typename Op>
+void
+check(const char* what, size_t size, Op op)
+{
+    WorkCounter& work = counter();
+    const bool enforced = work.instructions() && !kSanitized;
+    const Budget& budget = work.instructions() ? kInstructionBudget : kNanosecondBudget;
+    const unsigned long long limit = budget.fixed + budget.perByte * size;
+    unsigned long long best = 0;
+    for (int attempt = 0; attempt < kAttempts; ++attempt) {
+        work.start();
+        op();
+        unsigned long long used = work.stop();
+        if (!attempt || used < best)
+            best = used;
+        if (best <= limit)
+            return;
+    }
+    fprintf(stderr,
+            "perf_fuzz: %s used %llu %s on %zu bytes, budget %llu\n",
+            what,
+            best,
+            work.unit(),
+            size,
+            limit);
+    if (enforced)
+        abort();
+}
+
+// Runs query on json and aborts when its steps visit more nodes than the
+// budget for size bytes allows.
+void
+checkVisits(const char* query, size_t size, const Json& json)
+{
+    jt::JsonPathProfiler profiler;
+    jt::JsonPathProfiler* previous = jt::setJsonPathProfiler(&profiler);
+    json.jsonpath(query);
+    jt::setJsonPathProfiler(previous);
+    unsigned long long visits = 0;
+    for (const jt::JsonPathProfiler::Step& step : profiler.expressions[query].steps)
+        visits += step.frontier + step.nodesVisited + step.filterEvaluations;
+    const unsigned long long limit = kVisitBudget.fixed + kVisitBudget.perByte * size;
+    if (visits <= limit)
+        return;
+    fprintf(stderr,
+            "perf_fuzz: %s visited %llu nodes on %zu bytes, budget %llu\n",
+            query,
+            visits,
+            size,
+            limit);
+    abort();
+}
+
+} // namespace
+
+extern "C" int
+LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    const char* text = reinterpret_cast<const char*>(data);
+    std::pair<Json::Status, Json> result;
+    check("parse", size, [&] { result = Json::parse(text, size); });
+    if (result.first != Json::success)
+        return 0;
+    const Json& json = result.second;
+    check("toString", size, [&] { json.toString(); });
+    check("toStringPretty", size, [&] { json.toStringPretty(); });
+    for (const char* query : kQueries) {
+        checkVisits(query, size, json);
+        check(query, size, [&] { json.jsonpath(query); });
+    }
+    return 0;
+}
+
+#ifndef JTJSON_LIBFUZZER
+
+static bool
+runFile(const std::string& path)
+{
+    fprintf(stderr, "Running: %s\n", path.c_str());
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        perror(path.c_str());
+        return false;
+    }
+    std::string data;
+    char buf[65536];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.append(buf, got);
+    fclose(f);
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    return true;
+}
+
+static bool
+runPath(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st)) {
+        perror(path.c_str());
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode))
+        return runFile(path);
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        perror(path.c_str());
+        return false;
+    }
+    std::vector<std::string> names;
+    while (dirent* ent = readdir(dir))
+        if (ent->d_name[0] != '.')
+            names.push_back(ent->d_name);
+    closedir(dir);
+    bool ok = true;
+    for (const std::string& name : names)
+        ok = runPath(path + "/" + name) && ok;
+    return ok;
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s FILE|DIR...\n", argv[0]);
+        return 1;
+    }
+    bool ok = true;
+    for (int i = 1; i < argc; ++i)
+        ok = runPath(argv[i]) && ok;
+    return ok ? 0 : 1;
+}
+
+#endif